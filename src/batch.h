@@ -0,0 +1,178 @@
+#pragma once
+
+#include "common.h"
+
+#include <immintrin.h> // _pdep_u32
+#include <numeric>
+#include <tuple>
+
+/*
+    Batched sampling for the nonsymmetric samplers. Instead of sampling the
+    DAGs one at a time, all samples of a batch advance together:
+
+    - In each layering step, the samples are grouped by their state, i.e. the
+      previous layer and the set of placed nodes. The weights of the choices
+      of the next layer depend only on the state (the weights of the earlier
+      layers are a common factor), so the cumulative weights are computed once
+      per group.
+    - The random numbers of the samples in a group are sorted and resolved
+      in a single sweep over the cumulative weights.
+    - Parent sets are sampled in the same way, grouping the nodes of all
+      samples by the node, the previous layer and the placed nodes.
+
+    The first layering steps, which scan most of the 2^n choices, are shared
+    by many samples, so the time per DAG drops with the batch size. The state
+    of the samples is kept in a structure of arrays.
+
+    HatTable and Table may be any table types with operator()(R, U)
+    convertible to T, such as HatWeightTable and SubTable or FixedSubTable.
+*/
+namespace batch_ {
+
+// Sorts the random numbers and resolves them in one sweep over the
+// nondecreasing cumulative weights, calling f(sample, idx) with the index of
+// the first cumulative weight that exceeds the random number of the sample.
+// Index count - 1 is used if rounding leaves no such index.
+template <class T, class F>
+void sweep(std::vector<std::pair<T, size_t>>& randoms, const T* cumulative, size_t begin, size_t count, F f) {
+    std::sort(randoms.begin(), randoms.end(), [](const std::pair<T, size_t>& a, const std::pair<T, size_t>& b) {
+        return a.first < b.first;
+    });
+
+    size_t idx = begin;
+    for(const std::pair<T, size_t>& random : randoms) {
+        while(idx < count - 1 && !(cumulative[idx] > random.first)) {
+            ++idx;
+        }
+        f(random.second, idx);
+    }
+}
+
+template <class T, class HatTable, class Table>
+std::vector<std::vector<int>> sample_batch(int size, const std::vector<std::vector<T>>& weights,
+    const std::vector<HatTable>& hws, const Table& fs, size_t count) {
+
+    const uint32_t V = (uint32_t)(((uint64_t)1 << size) - 1);
+
+    // Layering state of each sample
+    std::vector<uint32_t> placed(count, 0);
+    std::vector<uint32_t> prev(count, 0);
+
+    // Parent sets to sample: the sample, the node, the previous layer and the
+    // nodes placed before the layer of the node
+    std::vector<uint32_t> task_sample;
+    std::vector<uint32_t> task_node;
+    std::vector<uint32_t> task_prev;
+    std::vector<uint32_t> task_placed;
+
+    std::vector<T> factors(size);
+    std::vector<T> products;
+    std::vector<T> cumulative;
+    std::vector<std::pair<T, size_t>> randoms;
+
+    std::vector<uint32_t> active(count);
+    std::iota(active.begin(), active.end(), 0);
+
+    while(!active.empty()) {
+        std::sort(active.begin(), active.end(), [&](uint32_t a, uint32_t b) {
+            return std::tie(placed[a], prev[a]) < std::tie(placed[b], prev[b]);
+        });
+
+        std::vector<uint32_t> next_active;
+        for(size_t begin = 0; begin < active.size();) {
+            uint32_t P = placed[active[begin]];
+            uint32_t Q = prev[active[begin]];
+            size_t end = begin + 1;
+            while(end < active.size() && placed[active[end]] == P && prev[active[end]] == Q) {
+                ++end;
+            }
+
+            // Index idx corresponds to the layer R = _pdep_u32(idx, U)
+            uint32_t U = V & ~P;
+            int m = 0;
+            for(uint32_t bits = U; bits; bits &= bits - 1) {
+                factors[m++] = hws[__builtin_ctz(bits)](Q, P);
+            }
+            size_t choices = (size_t)1 << m;
+            products.resize(choices);
+            cumulative.resize(choices);
+            products[0] = T::one();
+            cumulative[0] = T::zero();
+            for(size_t idx = 1; idx < choices; ++idx) {
+                products[idx] = products[idx & (idx - 1)] * factors[__builtin_ctzll(idx)];
+                cumulative[idx] = cumulative[idx - 1] + products[idx] * T(fs(_pdep_u32(idx, U), U));
+            }
+
+            randoms.clear();
+            for(size_t k = begin; k < end; ++k) {
+                randoms.emplace_back(T::uniform_rand(cumulative[choices - 1]), active[k]);
+            }
+            sweep(randoms, cumulative.data(), 1, choices, [&](size_t s, size_t idx) {
+                uint32_t R = _pdep_u32(idx, U);
+                if(P) {
+                    for(uint32_t bits = R; bits; bits &= bits - 1) {
+                        task_sample.push_back(s);
+                        task_node.push_back(__builtin_ctz(bits));
+                        task_prev.push_back(Q);
+                        task_placed.push_back(P);
+                    }
+                }
+                placed[s] |= R;
+                prev[s] = R;
+                if(placed[s] != V) {
+                    next_active.push_back(s);
+                }
+            });
+
+            begin = end;
+        }
+        active.swap(next_active);
+    }
+
+    std::vector<std::vector<int>> dags(count, std::vector<int>(size, 0));
+
+    std::vector<uint32_t> order(task_sample.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return std::tie(task_node[a], task_prev[a], task_placed[a]) < std::tie(task_node[b], task_prev[b], task_placed[b]);
+    });
+
+    std::vector<uint32_t> parent_sets;
+    for(size_t begin = 0; begin < order.size();) {
+        uint32_t node = task_node[order[begin]];
+        uint32_t Q = task_prev[order[begin]];
+        uint32_t P = task_placed[order[begin]];
+        size_t end = begin + 1;
+        while(end < order.size() && task_node[order[end]] == node && task_prev[order[end]] == Q && task_placed[order[end]] == P) {
+            ++end;
+        }
+
+        // The parent sets G of positive weight with G subset of P and G intersecting Q
+        const std::vector<T>& node_weights = weights[node];
+        parent_sets.clear();
+        cumulative.clear();
+        T total = T::zero();
+        for(uint32_t G = Q & -Q; G; G = ((G | ~P) + 1) & P) {
+            if((G & Q) && node_weights[G] > T::zero()) {
+                total = total + node_weights[G];
+                parent_sets.push_back(G);
+                cumulative.push_back(total);
+            }
+        }
+
+        assert(!parent_sets.empty());
+        randoms.clear();
+        for(size_t k = begin; k < end; ++k) {
+            randoms.emplace_back(T::uniform_rand(total), order[k]);
+        }
+        sweep(randoms, cumulative.data(), 0, cumulative.size(), [&](size_t task, size_t idx) {
+            dags[task_sample[task]][node] = parent_sets[idx];
+        });
+
+        begin = end;
+    }
+
+    return dags;
+}
+
+}
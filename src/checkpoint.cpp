@@ -0,0 +1,125 @@
+#include "checkpoint.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+Checkpoint::Checkpoint(std::string table_dir, std::string fingerprint, int size, bool resume) :
+    table_dir(std::move(table_dir)),
+    fingerprint(std::move(fingerprint)),
+    size(size),
+    hat_weights(0),
+    fs_layers(0)
+{
+    std::string lock_path = this->table_dir + "/lock";
+    lock_fd = open(lock_path.c_str(), O_RDWR | O_CREAT, 0644);
+    if(lock_fd < 0) {
+        std::cerr << "Could not open " << lock_path << ": " << strerror(errno) << "\n";
+        exit(1);
+    }
+    if(flock(lock_fd, LOCK_EX | LOCK_NB) != 0) {
+        std::cerr << "Waiting for another process using " << this->table_dir << "\n";
+        while(flock(lock_fd, LOCK_EX) != 0 && errno == EINTR) {}
+    }
+
+    bool resumed = false;
+    if(resume) {
+        std::ifstream fp(path());
+        std::string saved_fingerprint;
+        if(!fp.good()) {
+            std::cerr << "No saved progress in " << path() << ", starting from the beginning\n";
+        } else if(!(fp >> saved_fingerprint >> hat_weights >> fs_layers) || saved_fingerprint != this->fingerprint
+            || hat_weights < 0 || hat_weights > size || fs_layers < 0 || fs_layers > size || (fs_layers && hat_weights != size)) {
+            std::cerr << "Saved progress in " << path() << " does not match the model\n";
+            exit(1);
+        } else {
+            std::cerr << "Resuming with the hat weights of " << hat_weights << " nodes and " << fs_layers << " layers of fs done\n";
+            resumed = true;
+        }
+    }
+    // The saved progress is left untouched when resuming, so that several
+    // processes can share finished tables
+    if(!resumed) {
+        save();
+    }
+
+    start_time = std::chrono::steady_clock::now();
+    start_work = work_done();
+}
+
+Checkpoint::~Checkpoint() {
+    close(lock_fd);
+}
+
+void Checkpoint::finish_hat_weights(int node) {
+    assert(node == hat_weights);
+    ++hat_weights;
+    save();
+    report("Hat weights of node " + std::to_string(node));
+}
+
+void Checkpoint::finish_fs_layer(int k) {
+    assert(k == fs_layers + 1 && hat_weights == size);
+    ++fs_layers;
+    save();
+    report("Layer " + std::to_string(k) + "/" + std::to_string(size) + " of fs");
+}
+
+void Checkpoint::finish_all() {
+    hat_weights = size;
+    fs_layers = size;
+    save();
+}
+
+std::string Checkpoint::path() const {
+    return table_dir + "/progress";
+}
+
+void Checkpoint::save() const {
+    std::string tmp_path = path() + ".tmp";
+    {
+        std::ofstream fp(tmp_path);
+        fp << fingerprint << "\n" << hat_weights << "\n" << fs_layers << "\n";
+        fp.close();
+        if(!fp) {
+            std::cerr << "Could not write " << tmp_path << "\n";
+            exit(1);
+        }
+    }
+    if(std::rename(tmp_path.c_str(), path().c_str()) != 0) {
+        std::cerr << "Could not write " << path() << ": " << strerror(errno) << "\n";
+        exit(1);
+    }
+}
+
+double Checkpoint::work_done() const {
+    // Computing the hat weights of a node takes time proportional to
+    // 2n 3^(n-1), and layer k of fs to n C(n, k) 3^k.
+    double n = size;
+    double hat_weight_work = 2.0 * n * std::pow(3.0, n - 1.0);
+    double total = n * hat_weight_work;
+    double done = hat_weights * hat_weight_work;
+    double binomial = 1.0;
+    for(int k = 1; k <= size; ++k) {
+        binomial = binomial * (size - k + 1) / k;
+        double layer_work = n * binomial * std::pow(3.0, k);
+        total += layer_work;
+        if(k <= fs_layers) {
+            done += layer_work;
+        }
+    }
+    return done / total;
+}
+
+void Checkpoint::report(const std::string& unit) const {
+    double done = work_done();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    std::cerr << unit << " done, " << 100.0 * done << "% of precomputation";
+    if(done > start_work && done < 1.0) {
+        std::cerr << ", ETA " << elapsed * (1.0 - done) / (done - start_work) << "s";
+    }
+    std::cerr << "\n";
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "common.h"
+
+// Progress of the precomputation of a nonsymmetric sampler whose tables are
+// stored in files in table_dir. The units of work are the hat weights of each
+// node, computed in node order, and the layers of fs, computed in order of
+// increasing k. After each finished unit, once its table entries have been
+// written to the table files, the progress is saved to table_dir/progress,
+// so that an interrupted precomputation can be resumed from the last
+// finished unit. Each finished unit also prints the progress and an estimate
+// of the remaining time. Resuming a finished precomputation only reads the
+// tables, so any number of processes can do it at the same time.
+//
+// A Checkpoint holds an exclusive lock on table_dir/lock from its
+// construction, which waits for the lock, until its destruction. Processes
+// that resume an unfinished precomputation at the same time therefore take
+// turns: the first one finishes it, and the others then find it finished.
+class Checkpoint {
+public:
+    // fingerprint identifies the model and table type; a saved progress is
+    // only resumed if its fingerprint matches. Without resume, or if there is
+    // no saved progress, the precomputation starts from the beginning.
+    Checkpoint(std::string table_dir, std::string fingerprint, int size, bool resume);
+    ~Checkpoint();
+
+    Checkpoint(const Checkpoint&) = delete;
+    Checkpoint& operator=(const Checkpoint&) = delete;
+
+    // Number of nodes whose hat weights are finished
+    int hat_weights_done() const {
+        return hat_weights;
+    }
+    // Number of finished layers of fs
+    int fs_layers_done() const {
+        return fs_layers;
+    }
+
+    void finish_hat_weights(int node);
+    void finish_fs_layer(int k);
+    // Marks the whole precomputation finished without reporting
+    void finish_all();
+
+private:
+    std::string table_dir;
+    std::string fingerprint;
+    int size;
+    int hat_weights;
+    int fs_layers;
+    int lock_fd;
+
+    std::chrono::steady_clock::time_point start_time;
+    double start_work;
+
+    std::string path() const;
+    void save() const;
+    // Estimated work of the finished units, relative to the whole precomputation
+    double work_done() const;
+    void report(const std::string& unit) const;
+};
@@ -18,5 +18,6 @@
 #include <deque>
 #include <cstdlib>
 #include <memory>
+#include <limits>
 
 extern thread_local std::mt19937 rng;
@@ -0,0 +1,126 @@
+#pragma once
+
+#include "common.h"
+
+// Hard structural constraints on the sampled DAGs. The edge constraints and
+// tiers restrict the parent set of a single node, so they are applied to the
+// modular weights directly. The layer orderings cannot be expressed that way;
+// they are enforced by the layering samplers (see layer_allowed). Either way,
+// the samplers sample exactly from the conditional distribution.
+struct Constraints {
+    // required[i] / forbidden[i]: bit j is set if the edge j -> i is required / forbidden
+    std::vector<int> required;
+    std::vector<int> forbidden;
+    // earlier[i]: bit j is set if node j must be in an earlier layer than node i
+    // (see dag_layering), i.e. the longest path ending at j must be shorter
+    // than the longest path ending at i
+    std::vector<int> earlier;
+
+    Constraints() {}
+    Constraints(int size) : required(size, 0), forbidden(size, 0), earlier(size, 0) {}
+
+    // Layer ordering for the samplers: earlier, or an empty vector if no node
+    // has to be in an earlier layer than another.
+    std::vector<int> layer_order() const {
+        for(int nodes : earlier) {
+            if(nodes) {
+                return earlier;
+            }
+        }
+        return {};
+    }
+
+    bool allows(int node, int parents) const {
+        return (parents & required[node]) == required[node] && (parents & forbidden[node]) == 0;
+    }
+
+    // Forbids all edges from a node in a later tier to a node in an earlier tier.
+    // Nodes with tier -1 are not constrained.
+    void add_tiers(const std::vector<int>& tier) {
+        int size = (int)tier.size();
+        for(int i = 0; i < size; ++i) {
+            for(int j = 0; j < size; ++j) {
+                if(tier[i] != -1 && tier[j] != -1 && tier[j] > tier[i]) {
+                    forbidden[i] |= 1 << j;
+                }
+            }
+        }
+    }
+
+    // Returns false if some edge is both required and forbidden, or the
+    // required edges and layer orderings together contain a cycle.
+    bool consistent() const {
+        int size = (int)required.size();
+        for(int i = 0; i < size; ++i) {
+            if(required[i] & forbidden[i]) {
+                return false;
+            }
+        }
+
+        int placed = 0;
+        bool progress = true;
+        while(progress) {
+            progress = false;
+            for(int i = 0; i < size; ++i) {
+                if(!(placed & (1 << i)) && ((required[i] | earlier[i]) & ~placed) == 0) {
+                    placed |= 1 << i;
+                    progress = true;
+                }
+            }
+        }
+        return placed == (1 << size) - 1;
+    }
+};
+
+// Whether the layer R of a layering satisfies the layer ordering earlier (see
+// Constraints) when the nodes in U \ R are in later layers and all other nodes
+// in earlier ones. An empty ordering allows every layer.
+inline bool layer_allowed(const std::vector<int>& earlier, int R, int U) {
+    if(earlier.empty()) {
+        return true;
+    }
+    for(int bits = R; bits; bits &= bits - 1) {
+        if(earlier[__builtin_ctz(bits)] & U) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Sets the weights of all parent sets that violate the constraints to zero.
+// Returns false if this leaves some node without a parent set of positive weight.
+template <class T>
+bool apply_constraints(std::vector<std::vector<T>>& weights, const Constraints& constraints) {
+    int size = (int)weights.size();
+    bool ok = true;
+    for(int i = 0; i < size; ++i) {
+        bool any = false;
+        for(int S = 0; S < (int)weights[i].size(); ++S) {
+            if(!constraints.allows(i, S)) {
+                weights[i][S] = T::zero();
+            }
+            if(weights[i][S] > T::zero()) {
+                any = true;
+            }
+        }
+        ok = ok && any;
+    }
+    return ok;
+}
+
+// Expands weights given per parent set size into per-node parent set weights,
+// so that the symmetric weights can be sampled with constraints.
+template <class T>
+std::vector<std::vector<T>> expand_symmetric_weights(const std::vector<T>& weights) {
+    int size = (int)weights.size();
+    std::vector<std::vector<T>> ret(size);
+    for(int i = 0; i < size; ++i) {
+        ret[i].resize(1 << size, T::zero());
+        for(int S = 0; S < (1 << size); ++S) {
+            if(!(S & (1 << i))) {
+                ret[i][S] = weights[__builtin_popcount(S)];
+            }
+        }
+    }
+    return ret;
+}
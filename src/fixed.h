@@ -0,0 +1,355 @@
+#pragma once
+
+#include "batch.h"
+#include "common.h"
+#include "constraints.h"
+#include "lognum.h"
+#include "numa.h"
+
+#include <immintrin.h> // _pext_u32, _pdep_u32
+
+/*
+    Nonsymmetric sampler specialized at compile time for a fixed number of
+    nodes N. It computes the same tables and samples from the same distribution
+    as NonSymmetricSampler, but
+
+    - the tables are fixed-size arrays and all loops over nodes have constant bounds,
+    - sets are traversed with count-trailing-zeros loops instead of testing every bit,
+    - products of hat weights over subsets are built incrementally, one node at a time,
+    - the singleton hat weights are computed with subset-sum transforms and the
+      other hat weights with the recursion hw(R, t) = hw({k}, t) + hw(R\{k}, t\{k})
+      where k is the smallest node in R,
+    - sampling uses binary search in cumulative weights.
+*/
+namespace fixed_ {
+
+// Largest number of nodes for which the specialized sampler is instantiated.
+const int MAX_SIZE = 16;
+
+constexpr size_t pow3(int n) {
+    return n == 0 ? 1 : 3 * pow3(n - 1);
+}
+
+// Offset of the row U in FixedSubTable<T, N>; the rows are in the order of U.
+template <int N>
+const std::array<uint32_t, (1 << N)>& subtable_offsets() {
+    static const std::array<uint32_t, (1 << N)> offsets = []() {
+        std::array<uint32_t, (1 << N)> ret;
+        uint32_t pos = 0;
+        for(uint32_t U = 0; U < ((uint32_t)1 << N); ++U) {
+            ret[U] = pos;
+            pos += (uint32_t)1 << __builtin_popcount(U);
+        }
+        return ret;
+    }();
+    return offsets;
+}
+
+// Same as SubTable<T> with n = N, stored in a fixed-size array.
+template <class T, int N>
+class FixedSubTable {
+public:
+    FixedSubTable() :
+        data(new std::array<T, pow3(N)>()),
+        offset(subtable_offsets<N>().data())
+    {}
+    FixedSubTable(const FixedSubTable& other) :
+        data(new std::array<T, pow3(N)>(*other.data)),
+        offset(other.offset)
+    {}
+    FixedSubTable(FixedSubTable&&) noexcept = default;
+
+    T& operator()(uint32_t R, uint32_t U) {
+        return (*data)[offset[U] + _pext_u32(R, U)];
+    }
+    const T& operator()(uint32_t R, uint32_t U) const {
+        return (*data)[offset[U] + _pext_u32(R, U)];
+    }
+
+    // Spreads the entries evenly over the NUMA nodes.
+    void interleave(const std::vector<int>& nodes) const {
+        numa_interleave(data->data(), sizeof(*data), nodes);
+    }
+
+    // Entries (R, U) for all R subsets of U, indexed by _pext_u32(R, U)
+    const T* row(uint32_t U) const {
+        return data->data() + offset[U];
+    }
+
+private:
+    std::unique_ptr<std::array<T, pow3(N)>> data;
+    const uint32_t* offset;
+};
+
+template <class T, int N>
+void calculate_node_hat_weights(int i, const std::vector<T>& weights, FixedSubTable<T, N>& hw) {
+    const uint32_t V = ((uint32_t)1 << N) - 1;
+    const uint32_t V_sub_i = V & ~((uint32_t)1 << i);
+
+    uint32_t required = V_sub_i;
+    for(uint32_t S = 0; S <= V_sub_i; S = ((S | ~V_sub_i) + 1) & V_sub_i) {
+        if(weights[S] > T::zero()) {
+            required &= S;
+        }
+        if(S == V_sub_i) {
+            break;
+        }
+    }
+
+    // sums[t]: sum of the weights of all subsets of t
+    std::vector<T> sums(V + 1, T::zero());
+    for(uint32_t S = 0; S <= V; ++S) {
+        if(!(S & ~V_sub_i)) {
+            sums[S] = weights[S];
+        }
+    }
+    for(int b = 0; b < N; ++b) {
+        for(uint32_t S = 0; S <= V; ++S) {
+            if(S & ((uint32_t)1 << b)) {
+                sums[S] = sums[S] + sums[S ^ ((uint32_t)1 << b)];
+            }
+        }
+    }
+
+    // singleton[p][t]: sum of the weights of the subsets of t that contain p
+    std::vector<std::vector<T>> singleton(N);
+    for(int p = 0; p < N; ++p) {
+        if(p == i) {
+            continue;
+        }
+        uint32_t node = (uint32_t)1 << p;
+        std::vector<T>& sp = singleton[p];
+        sp.assign(V + 1, T::zero());
+        for(uint32_t S = 0; S <= V; ++S) {
+            if((S & node) && !(S & ~V_sub_i)) {
+                sp[S] = weights[S];
+            }
+        }
+        for(int b = 0; b < N; ++b) {
+            if(b == p) {
+                continue;
+            }
+            for(uint32_t S = 0; S <= V; ++S) {
+                if(S & ((uint32_t)1 << b)) {
+                    sp[S] = sp[S] + sp[S ^ ((uint32_t)1 << b)];
+                }
+            }
+        }
+    }
+
+    hw(0, 0) = weights[0];
+    for(uint32_t t = 1; t <= V; ++t) {
+        if((t & ~V_sub_i) || (t & required) != required) {
+            continue;
+        }
+        hw(0, t) = sums[t];
+        for(uint32_t R = t; R; R = (R - 1) & t) {
+            uint32_t low = R & -R;
+            int k = __builtin_ctz(R);
+            if(R == low) {
+                hw(R, t) = singleton[k][t];
+            } else {
+                hw(R, t) = singleton[k][t] + hw(R ^ low, t ^ low);
+            }
+        }
+    }
+}
+
+// The entries whose layer violates the layer ordering earlier are zero, as in monotone_calculate_fs.
+template <class T, int N>
+void calculate_fs(const std::vector<FixedSubTable<T, N>>& hws, FixedSubTable<T, N>& fs,
+    const std::vector<int>& earlier = std::vector<int>()) {
+    const uint32_t V = ((uint32_t)1 << N) - 1;
+
+    std::vector<T> products((size_t)1 << N);
+    std::array<T, N> factors;
+
+    fs(0, 0) = T::one();
+    for(uint32_t U = 1; U <= V; ++U) {
+        fs(U, U) = layer_allowed(earlier, U, U) ? T::one() : T::zero();
+        for(uint32_t S_0 = (U - 1) & U; S_0; S_0 = (S_0 - 1) & U) {
+            if(!layer_allowed(earlier, S_0, U)) {
+                fs(S_0, U) = T::zero();
+                continue;
+            }
+            uint32_t upmask = U & ~S_0;
+            uint32_t avail = V & ~upmask;
+
+            int m = 0;
+            for(uint32_t bits = upmask; bits; bits &= bits - 1) {
+                factors[m++] = hws[__builtin_ctz(bits)](S_0, avail);
+            }
+
+            // Index idx corresponds to the set S_1 = _pdep_u32(idx, upmask)
+            const T* fs_row = fs.row(upmask);
+            products[0] = T::one();
+            T sum = T::zero();
+            for(uint32_t idx = 1; idx < ((uint32_t)1 << m); ++idx) {
+                products[idx] = products[idx & (idx - 1)] * factors[__builtin_ctz(idx)];
+                sum = sum + products[idx] * fs_row[idx];
+            }
+            fs(S_0, U) = sum;
+        }
+    }
+}
+
+template <class T, int N>
+std::vector<uint32_t> sample_layering(const std::vector<FixedSubTable<T, N>>& hws, const FixedSubTable<T, N>& fs) {
+    const uint32_t V = ((uint32_t)1 << N) - 1;
+
+    std::vector<uint32_t> layering;
+    layering.push_back(0);
+
+    // Allocated once per thread, as they take 2^(N+1) entries
+    static thread_local std::vector<T> products((size_t)1 << N);
+    static thread_local std::vector<T> cumulative((size_t)1 << N);
+    std::array<T, N> factors;
+
+    // The weights of the previous layers are a common factor of all choices
+    // of the next layer, so they do not affect its distribution.
+    uint32_t placed = 0;
+    while(placed != V) {
+        uint32_t U = V & ~placed;
+        uint32_t prev = layering.back();
+
+        int m = 0;
+        for(uint32_t bits = U; bits; bits &= bits - 1) {
+            factors[m++] = hws[__builtin_ctz(bits)](prev, placed);
+        }
+
+        const T* fs_row = fs.row(U);
+        products[0] = T::one();
+        cumulative[0] = T::zero();
+        uint32_t count = (uint32_t)1 << m;
+        for(uint32_t idx = 1; idx < count; ++idx) {
+            products[idx] = products[idx & (idx - 1)] * factors[__builtin_ctz(idx)];
+            cumulative[idx] = cumulative[idx - 1] + products[idx] * fs_row[idx];
+        }
+
+        T random_number = T::uniform_rand(cumulative[count - 1]);
+        uint32_t idx = std::upper_bound(cumulative.begin() + 1, cumulative.begin() + count, random_number) - cumulative.begin();
+        if(idx == count) {
+            idx = count - 1;
+        }
+
+        uint32_t R = _pdep_u32(idx, U);
+        layering.push_back(R);
+        placed |= R;
+    }
+
+    return layering;
+}
+
+template <class T, int N>
+std::vector<int> sample_parents(const std::vector<uint32_t>& layering, const std::vector<std::vector<T>>& weights,
+    const std::vector<FixedSubTable<T, N>>& hws) {
+
+    std::vector<int> dag(N, 0);
+
+    uint32_t U = layering[1];
+    for(size_t j = 2; j < layering.size(); ++j) {
+        uint32_t prev = layering[j - 1];
+        for(uint32_t bits = layering[j]; bits; bits &= bits - 1) {
+            int node = __builtin_ctz(bits);
+            const std::vector<T>& node_weights = weights[node];
+
+            // Total weight of the parent sets G of U that intersect prev
+            T random_number = T::uniform_rand(hws[node](prev, U));
+            T cumulative = T::zero();
+            uint32_t chosen = 0;
+            for(uint32_t G = prev & -prev; G; G = ((G | ~U) + 1) & U) {
+                if(G & prev) {
+                    T weight = node_weights[G];
+                    if(weight > T::zero()) {
+                        chosen = G;
+                        cumulative = cumulative + weight;
+                        if(cumulative > random_number) {
+                            break;
+                        }
+                    }
+                }
+            }
+            dag[node] = chosen;
+        }
+        U |= layering[j];
+    }
+
+    return dag;
+}
+
+}
+
+template <class T, int N>
+class FixedNonSymmetricSampler {
+public:
+    typedef std::vector<std::vector<T>> WeightT;
+
+    // Only the DAGs whose layering satisfies the layer ordering earlier are
+    // sampled, as in NonSymmetricSampler.
+    FixedNonSymmetricSampler(WeightT weights, std::vector<int> earlier = {}) :
+        weights(std::move(weights)),
+        earlier(std::move(earlier)),
+        h(N)
+    {
+        assert(this->weights.size() == N);
+        preprocess();
+    }
+
+    std::vector<int> sample() const {
+        using namespace fixed_;
+
+        std::vector<uint32_t> layering = sample_layering<T, N>(h, fs);
+        return sample_parents<T, N>(layering, weights, h);
+    }
+
+    // Samples count DAGs together, see batch.h.
+    std::vector<std::vector<int>> sample_batch(size_t count) const {
+        return batch_::sample_batch<T>(N, weights, h, fs, count);
+    }
+
+    int size() const {
+        return N;
+    }
+
+    // Same as in NonSymmetricSampler
+    T total_weight() const {
+        const uint32_t V = ((uint32_t)1 << N) - 1;
+        T total = T::zero();
+        for(uint32_t R = V; R; R = (R - 1) & V) {
+            T product = fs(R, V);
+            for(uint32_t bits = R; bits; bits &= bits - 1) {
+                product = product * h[__builtin_ctz(bits)](0, 0);
+            }
+            total = total + product;
+        }
+        return total;
+    }
+    T hat_weight_entry(int node, int R, int U) const {
+        return h[node](R, U);
+    }
+    T fs_entry(int R, int U) const {
+        return fs(R, U);
+    }
+
+    void interleave_tables(const std::vector<int>& nodes) const {
+        for(const fixed_::FixedSubTable<T, N>& table : h) {
+            table.interleave(nodes);
+        }
+        fs.interleave(nodes);
+    }
+
+private:
+    WeightT weights;
+    std::vector<int> earlier;
+    std::vector<fixed_::FixedSubTable<T, N>> h;
+    fixed_::FixedSubTable<T, N> fs;
+
+    void preprocess() {
+        using namespace fixed_;
+
+        for(int i = 0; i < N; ++i) {
+            calculate_node_hat_weights<T, N>(i, weights[i], h[i]);
+        }
+        calculate_fs<T, N>(h, fs, earlier);
+    }
+};
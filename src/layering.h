@@ -0,0 +1,30 @@
+#pragma once
+
+#include "common.h"
+
+// Layering of the DAG in the form used by the samplers: layering[0] = 0, and
+// layering[j] for j >= 1 is the set of the nodes that are not in the earlier
+// layers and whose parents all are. Every node in a layer j >= 2 thus has a
+// parent in layer j - 1, and this is the layering that the samplers sample
+// together with the DAG. Returns an empty vector if the graph has a cycle.
+inline std::vector<int> dag_layering(const std::vector<int>& dag) {
+    int size = dag.size();
+    int V = (int)(((int64_t)1 << size) - 1);
+
+    std::vector<int> layering = {0};
+    int placed = 0;
+    while(placed != V) {
+        int layer = 0;
+        for(int i = 0; i < size; ++i) {
+            if(!(placed & (1 << i)) && (dag[i] & ~placed) == 0) {
+                layer |= 1 << i;
+            }
+        }
+        if(!layer) {
+            return {};
+        }
+        layering.push_back(layer);
+        placed |= layer;
+    }
+    return layering;
+}
@@ -27,6 +27,10 @@ public:
 		return Lognum(val);
 	}
 
+	double to_log() const {
+		return log_value;
+	}
+
 	static Lognum zero() {
 		return Lognum();
 	}
@@ -57,6 +61,10 @@ public:
 		return Lognum(this->log_value + other.log_value);
 	}
 
+	Lognum operator/(Lognum other) const {
+		return Lognum(this->log_value - other.log_value);
+	}
+
 	Lognum operator+(Lognum l2) const {
 		double log1 = this->log_value;
 		double log2 = l2.log_value;
@@ -72,6 +80,12 @@ public:
 		}
 	}
 
+	bool operator==(Lognum o) const {
+		return log_value == o.log_value;
+	}
+	bool operator!=(Lognum o) const {
+		return log_value != o.log_value;
+	}
 	bool operator<(Lognum o) const {
 		return log_value < o.log_value;
 	}
@@ -85,3 +99,29 @@ public:
 		return log_value >= o.log_value;
 	}
 };
+
+// Lognum stored in single precision, used to halve the memory of large tables.
+// Storing a value with logarithm x changes the logarithm by at most
+// storage_roundoff<LogFloat>() * |x|.
+class LogFloat {
+private:
+	float log_value;
+
+public:
+	LogFloat() : log_value(-INFINITY) {}
+	LogFloat(Lognum val) : log_value((float)val.to_log()) {}
+
+	operator Lognum() const {
+		return Lognum::from_log(log_value);
+	}
+};
+
+// Bound for the relative error of the logarithm introduced by storing a Lognum as type S.
+template <class S>
+double storage_roundoff() {
+	return 0.0;
+}
+template <>
+inline double storage_roundoff<LogFloat>() {
+	return std::numeric_limits<float>::epsilon() / 2.0;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "common.h"
+
+// Number type of the max-times semiring in log space: addition takes the
+// maximum and multiplication is the usual one. Running the samplers with
+// MaxLognum computes maxima instead of sums in all tables, and the sampling
+// steps pick a choice of maximum weight: uniform_rand(upper_bound) returns
+// the largest value below upper_bound, so the first choice whose cumulative
+// maximum exceeds it is the first choice with the maximum weight. Thus, for
+// example, NonSymmetricSampler<MaxLognum>::sample() returns a DAG of maximum
+// weight, and total_weight() returns that weight.
+class MaxLognum {
+private:
+	double log_value;
+
+	MaxLognum(double log_value) : log_value(log_value) {}
+
+public:
+	MaxLognum() : MaxLognum(-INFINITY) {}
+
+	static MaxLognum from_double(double val) {
+		return MaxLognum(std::log(val));
+	}
+	static MaxLognum from_log(double val) {
+		return MaxLognum(val);
+	}
+
+	double to_log() const {
+		return log_value;
+	}
+
+	static MaxLognum zero() {
+		return MaxLognum();
+	}
+	static MaxLognum one() {
+		return MaxLognum(0.0);
+	}
+
+	static MaxLognum uniform_rand(MaxLognum upper_bound) {
+		return MaxLognum(std::nextafter(upper_bound.log_value, -INFINITY));
+	}
+
+	// All subsets of the same size have the same weight, so the maximum does not depend on their number
+	static MaxLognum binomial(int, int) {
+		return one();
+	}
+
+	MaxLognum powi(int exponent) const {
+		return MaxLognum((double)exponent * log_value);
+	}
+
+	MaxLognum operator*(MaxLognum other) const {
+		return MaxLognum(this->log_value + other.log_value);
+	}
+
+	MaxLognum operator/(MaxLognum other) const {
+		return MaxLognum(this->log_value - other.log_value);
+	}
+
+	MaxLognum operator+(MaxLognum other) const {
+		return MaxLognum(std::max(this->log_value, other.log_value));
+	}
+
+	bool operator==(MaxLognum o) const {
+		return log_value == o.log_value;
+	}
+	bool operator!=(MaxLognum o) const {
+		return log_value != o.log_value;
+	}
+	bool operator<(MaxLognum o) const {
+		return log_value < o.log_value;
+	}
+	bool operator>(MaxLognum o) const {
+		return log_value > o.log_value;
+	}
+	bool operator<=(MaxLognum o) const {
+		return log_value <= o.log_value;
+	}
+	bool operator>=(MaxLognum o) const {
+		return log_value >= o.log_value;
+	}
+};
@@ -1,221 +1,300 @@
 #pragma once
 
+#include "batch.h"
+#include "checkpoint.h"
 #include "common.h"
+#include "constraints.h"
+#include "layering.h"
 #include "lognum.h"
 #include "subtable.h"
 
+#include <immintrin.h> // _pdep_u32
+#include <sstream>
+
 namespace nonsymmetric_ {
 
-template <class T>
-std::vector<SubTable<T>> calculate_hat_weights(int size, const std::vector<std::vector<T>>& weights) {
+// Paths of the table files in table_dir, or empty paths for tables in memory.
+inline std::string hat_weight_path(const std::string& table_dir, int i) {
+    return table_dir.empty() ? "" : table_dir + "/hw" + std::to_string(i) + ".tbl";
+}
+inline std::string fs_path(const std::string& table_dir) {
+    return table_dir.empty() ? "" : table_dir + "/fs.tbl";
+}
+
+template <class T, class Stored = T>
+HatWeightTable<T, Stored> calculate_node_hat_weights(int size, int i, const std::vector<T>& weights, const std::string& path = "") {
 	/*
-		Section 3.1 in the article
+		Section 3.1 in the article, for a single node i. The table only depends on the weights of node i.
+		If path is nonempty, the table is stored in that file, which the
+		caller moves into place with finish().
+		The entries are computed in the order of the rows U = (V \ t) | R of
+		the table (see HatWeightTable), which is the order in which
+		monotone_calculate_fs reads them, and each finished layer of rows is
+		written back to the file. With k the smallest node of R,
+		hw(R, t) = hw(R \ {k}, t) + hw({k}, t \ (R \ {k}))
+		where the first term is in the row U \ {k} of the previous layer and
+		the second in the row U. Entries with i in t are not used and are zero.
 	*/
 
-    std::vector<std::vector<T>> hat_weights_1;
-    std::vector<SubTable<T>> hat_weights_2;
+    HatWeightTable<T, Stored> hat_weights(size, path);
 
-    for (int i = 0; i < size+1; ++i)
-    {
-        std::vector<T> vectA1(((size_t)1 << size), T::zero());
-        SubTable<T> vectB1(size);
-        hat_weights_1.push_back(vectA1);
-        hat_weights_2.push_back(vectB1);
-    }
+    uint32_t V = ((size_t)1 << size)-1;
+    uint32_t V_sub_i = V & ~((uint32_t)1 << i);
 
+    // Parents that appear in every parent set of positive weight (e.g. because
+    // of required edges). Sets t that miss any of them have all hat weights zero.
+    uint32_t required = V_sub_i;
+    for(uint32_t S = 0; S <= V_sub_i; ++S) {
+        if(!(S & ~V_sub_i) && weights[S] > T::zero()) {
+            required &= S;
+        }
+    }
 
-    for (int i = 0; i < size; ++i)
-    {
-        std::bitset<32> V(((size_t)1 << size)-1);
-        V[i] = 0;
-        int V_sub_i = (int)V.to_ulong();
-
-        hat_weights_1[i][0] = weights[i][0];
-        hat_weights_2[i](0, 0) = weights[i][0];
-
-        //Go through all nonempty subsets of V\{i};
-        for (int t = 0; (t=(t-V_sub_i)&V_sub_i);)
-        {
-            T sum_1 = weights[i][0];
-            for (int S1 = 0; (S1=(S1-t)&t);)
-            {
-                sum_1 = sum_1 + weights[i][S1];
+    // sums[t]: hw(0, t), the sum of the weights of all subsets of t
+    std::vector<T> sums(((size_t)1 << size), T::zero());
+    for(uint32_t S = 0; S <= V; ++S) {
+        if(!(S & ~V_sub_i)) {
+            sums[S] = weights[S];
+        }
+    }
+    for(int b = 0; b < size; ++b) {
+        for(uint32_t S = 0; S <= V; ++S) {
+            if(S & ((uint32_t)1 << b)) {
+                sums[S] = sums[S] + sums[S ^ ((uint32_t)1 << b)];
             }
-            hat_weights_1[i][t] = sum_1;
-
-            /*SINGLETON CASE*/
-            for(int p = 0; p < size; p++) {
-                int node = (size_t)1 << p;
-                if((t&node) != 0) {
-                    T sum_2 = T::zero();
-                    for(int S = 0; (S=(S-t)&t);) {
-                        if((S&node) != 0) {
-                            sum_2 = sum_2 + weights[i][S];
+        }
+    }
+
+    // The row U = 0 holds hw(0, V)
+    hat_weights.by_row(0, 0) = T::zero();
+    hat_weights.flush_layer(0);
+
+    for(int k = 1; k <= size; ++k) {
+        for(uint32_t U = ((uint32_t)1 << k) - 1; U <= V; U = next_same_popcount(U)) {
+            for(uint32_t R = 0; ; R = (R - U) & U) {
+                uint32_t t = (V & ~U) | R;
+                T value = T::zero();
+                if((t & ~V_sub_i) || (t & required) != required) {
+                    // Written explicitly, as the entries of a new table file are not initialized
+                } else if(!R) {
+                    value = sums[t];
+                } else if(!(R & (R - 1))) {
+                    // Singleton: the parent sets of t that contain R
+                    uint32_t rest = t & ~R;
+                    for(uint32_t S = 0; ; S = (S - rest) & rest) {
+                        value = value + weights[S | R];
+                        if(S == rest) {
+                            break;
                         }
                     }
-                    hat_weights_2[i](node, t) = sum_2;
+                } else {
+                    uint32_t low = R & -R;
+                    value = T(hat_weights.by_row(R ^ low, U ^ low)) + T(hat_weights.by_row(low, U));
                 }
-            }
-
-            for(int R = 0; (R=(R-t)&t);) {
-                T sum = T::zero();
-                std::bitset<32> R_bits(R);
-                int previous = 0;
-                for(int k = 0; k < size; k++) {
-                    if(R_bits[k] == 1) {
-                        int k_num = (size_t)1 << k;
-                        int set = t;
-
-                        set = set&(~previous);
-                        previous = previous|k_num;
-                        sum = sum + hat_weights_2[i](k_num, set);
-                    }
+                hat_weights.by_row(R, U) = value;
+                if(R == U) {
+                    break;
                 }
-                hat_weights_2[i](R, t) = sum;
             }
+        }
+        hat_weights.flush_layer(k);
+    }
+
+    return hat_weights;
+}
+
+template <class T, class Stored = T>
+std::vector<HatWeightTable<T, Stored>> calculate_hat_weights(int size, const std::vector<std::vector<T>>& weights, const std::string& table_dir = "",
+    Checkpoint* checkpoint = nullptr) {
+	/*
+		Section 3.1 in the article
+		With a checkpoint, the tables of the nodes already done are read from
+		their files in table_dir.
+	*/
+
+    std::vector<HatWeightTable<T, Stored>> hat_weights_2;
 
-            hat_weights_2[i](0,t) = hat_weights_1[i][t];
+    for (int i = 0; i < size; ++i)
+    {
+        if(checkpoint && i < checkpoint->hat_weights_done()) {
+            hat_weights_2.emplace_back(size, hat_weight_path(table_dir, i), true);
+            continue;
+        }
+        hat_weights_2.push_back(calculate_node_hat_weights<T, Stored>(size, i, weights[i], hat_weight_path(table_dir, i)));
+        hat_weights_2.back().finish();
+        if(checkpoint) {
+            checkpoint->finish_hat_weights(i);
         }
     }
 
     return hat_weights_2;
 }
 
-template <class T>
-SubTable<T> monotone_calculate_fs(int size, const std::vector<SubTable<T>> &hws) {
+template <class T, class Stored>
+void monotone_calculate_fs(int size, const std::vector<HatWeightTable<T, Stored>> &hws, SubTable<T, Stored>& fs, int changed,
+    Checkpoint* checkpoint = nullptr, const std::vector<int>& earlier = std::vector<int>()) {
 	/*
 	Section 3.1.1
 	MONOTONE VERSION.
+	Only the entries fs(S_0, U) that depend on the hat weights of the nodes in
+	the set `changed` are (re)computed. By the recursion, fs(S_0, U) depends on
+	hws[i] exactly for the nodes i in U\S_0.
+	The sets U are processed in layers of increasing |U|, as fs(., U) only
+	depends on entries of smaller sets. The hat weights hws[i](S_0, V\upmask)
+	are the entries (S_0, U) in the row U of the hat weight tables (see
+	HatWeightTable), so their rows are read in the order in which they are
+	stored. Each finished layer is flushed to the
+	backing file of fs, if any, which the caller moves into place with
+	finish(). With a checkpoint, the layers already done are skipped.
+	The entries whose layer S_0 violates the layer ordering earlier are zero,
+	so that no layering through them is sampled.
 	*/
-    SubTable<T> fs(size);
-
-    fs(0, 0) = T::one();
+    if(!checkpoint || checkpoint->fs_layers_done() == 0) {
+        fs(0, 0) = T::one();
+    }
 
     std::bitset<32> V(((size_t)1 << size)-1);
     int V_sub = (int) V.to_ulong();
 
-    for (int U=0; (U=(U-V_sub)&V_sub);) {
-        for (int S_0 = 0; (S_0=(S_0-U)&U);) {
-        int upmask = U&(~S_0);
-        if(S_0 == U) {
-            fs(S_0,U) = T::one();
-        } else {
-            T sum1 = T::zero();
-            for (int S_1 = 0; (S_1=(S_1-upmask)&upmask);) {
-
-                T product = T::one();
-                std::bitset<32> S_1_bits(S_1);
-
-                for (int i = 0; i < size; i++) {
-                    if(S_1_bits[i] == 1) {
-                        product = product*hws[i](S_0, V_sub&(~upmask));
+    for (int k = checkpoint ? checkpoint->fs_layers_done() + 1 : 1; k <= size; ++k) {
+        for (int U = (1 << k) - 1; U <= V_sub; U = next_same_popcount(U)) {
+            for (int S_0 = 0; (S_0=(S_0-U)&U);) {
+                int upmask = U&(~S_0);
+                if(!layer_allowed(earlier, S_0, U)) {
+                    fs(S_0,U) = T::zero();
+                } else if(S_0 == U) {
+                    fs(S_0,U) = T::one();
+                } else if((upmask&changed) != 0) {
+                    T sum1 = T::zero();
+                    for (int S_1 = 0; (S_1=(S_1-upmask)&upmask);) {
+
+                        T product = T::one();
+                        std::bitset<32> S_1_bits(S_1);
+
+                        for (int i = 0; i < size; i++) {
+                            if(S_1_bits[i] == 1) {
+                                product = product*hws[i].by_row(S_0, U);
+                            }
+                        }
+                        product = product*fs(S_1, U&(~S_0));
+                        sum1 = sum1 + product;
                     }
+                    fs(S_0, U) = sum1;
                 }
-                product = product*fs(S_1, U&(~S_0));
-                sum1 = sum1 + product;
-            }
-            fs(S_0, U) = sum1;
             }
         }
+        fs.flush_layer(k);
+        if(checkpoint) {
+            checkpoint->finish_fs_layer(k);
+        }
     }
+}
 
+template <class T, class Stored>
+SubTable<T, Stored> monotone_calculate_fs(int size, const std::vector<HatWeightTable<T, Stored>> &hws, const std::string& path = "",
+    Checkpoint* checkpoint = nullptr, const std::vector<int>& earlier = std::vector<int>()) {
+    SubTable<T, Stored> fs(size, path, checkpoint && checkpoint->fs_layers_done() > 0);
+    monotone_calculate_fs<T, Stored>(size, hws, fs, ((size_t)1 << size)-1, checkpoint, earlier);
+    fs.finish();
     return fs;
 }
 
-template <class T>
-std::vector<int> sample_layering(int size, const std::vector<SubTable<T>>& hws, SubTable<T> fs) {
+// Samples the remaining layers of the layering, which starts with 0 followed by
+// the layers sampled so far, from the distribution conditioned on the layers so
+// far. The probability of the sampled layers is multiplied into probability.
+template <class T, class Stored>
+void extend_layering(int size, const std::vector<HatWeightTable<T, Stored>>& hws, const SubTable<T, Stored>& fs,
+    std::vector<int>& layering, T& probability) {
 	/*
 	Section 3.2.
 	*/
-    std::vector<int> layering;
-    layering.push_back(0);
-    
-    int partition_count = 0;
-    int j = 1;
-    int previous_rs = 0;
-    int U;
-    int V = ((size_t)1 << size)-1;
-
-
-    while(partition_count < size) {
-        U = V&(~previous_rs);
-        std::bitset<32> U_bits(U);
-        T upper_bound = T::zero();
-
-        std::vector<T> bounds(U+1, T::zero());
-        for(int R = 0; (R=(R-U)&U);) {
-            T product = T::one();
-            T inner_product = T::one();
-            int r_k_union = 0;
-
-            for (int k = 1; k <= j-1; k++) {
-                int r_mk = layering[k-1];
-                r_k_union = r_k_union|r_mk;
-
-                std::bitset<32> r_k_bits(layering[k]);
-                for (int i = 0; i < size; i++) {
-                    if(r_k_bits[i] == 1) {
-                        T prev = hws[i](r_mk, r_k_union);
-                        inner_product = inner_product*prev;
-                    }
-                }
-            }
-
-            product = inner_product;
-
-            int r_mj = layering[j-1];
-            std::bitset<32> r_bits(R);
-
-            for (int i = 0; i < size; i++) {
-                if(r_bits[i] == 1) {
-                    T prev = hws[i](r_mj, V&(~U));
-                    product = product*prev;
-                }
-            }
-            product = product*fs(R, U);
-            upper_bound = upper_bound + product;
+    const uint32_t V = ((size_t)1 << size)-1;
+    uint32_t placed = 0;
+    for(int layer : layering) {
+        placed |= layer;
+    }
 
-            bounds[R] = upper_bound;
+    // Allocated once per thread, as they take 2^(n+1) entries
+    static thread_local std::vector<T> products;
+    static thread_local std::vector<T> cumulative;
+    products.resize((size_t)1 << size);
+    cumulative.resize((size_t)1 << size);
+    std::vector<T> factors(size);
+
+    // As in fixed.h, the weights of the layers so far are a common factor of
+    // all choices of the next layer, so they do not affect its distribution.
+    while(placed != V) {
+        uint32_t U = V & ~placed;
+        uint32_t prev = layering.back();
+
+        int m = 0;
+        for(uint32_t bits = U; bits; bits &= bits - 1) {
+            factors[m++] = hws[__builtin_ctz(bits)](prev, placed);
         }
 
-        T random_number = T::uniform_rand(upper_bound);
-        for(int R = 0; (R=(R-U)&U);) {
-            if(bounds[R] > random_number) {
-                layering.push_back(R);
-                previous_rs = previous_rs|R;
-                break;
-            }
+        const Stored* fs_row = fs.row(U);
+        products[0] = T::one();
+        cumulative[0] = T::zero();
+        uint32_t count = (uint32_t)1 << m;
+        for(uint32_t idx = 1; idx < count; ++idx) {
+            products[idx] = products[idx & (idx - 1)] * factors[__builtin_ctz(idx)];
+            cumulative[idx] = cumulative[idx - 1] + products[idx] * (T)fs_row[idx];
         }
 
-        std::bitset<32> added(layering[j]);
-        for (int i = 0; i < size; i++) {
-            if(added[i] == 1) {
-                partition_count = partition_count +1;
-            }
+        T random_number = T::uniform_rand(cumulative[count - 1]);
+        uint32_t idx = std::upper_bound(cumulative.begin() + 1, cumulative.begin() + count, random_number) - cumulative.begin();
+        if(idx == count) {
+            idx = count - 1;
         }
-        j = j + 1;
+
+        uint32_t R = _pdep_u32(idx, U);
+        probability = probability * (products[idx] * (T)fs_row[idx] / cumulative[count - 1]);
+        layering.push_back(R);
+        placed |= R;
     }
+}
 
+template <class T, class Stored>
+std::vector<int> sample_layering(int size, const std::vector<HatWeightTable<T, Stored>>& hws, const SubTable<T, Stored>& fs) {
+    std::vector<int> layering;
+    layering.push_back(0);
+
+    T probability = T::one();
+    extend_layering<T, Stored>(size, hws, fs, layering, probability);
     return layering;
 }
 
+// Divides the weights of each node by their maximum. This does not change the
+// distribution, as every DAG has exactly one parent set for each node.
 template <class T>
-std::vector<int> sample_parents_ns(int size, const std::vector<int>& layering,
-	const std::vector<std::vector<T>>& weights) {
+void normalize_weights(std::vector<std::vector<T>>& weights) {
+    for(std::vector<T>& node_weights : weights) {
+        T max_weight = *std::max_element(node_weights.begin(), node_weights.end());
+        if(max_weight > T::zero()) {
+            for(T& weight : node_weights) {
+                weight = weight / max_weight;
+            }
+        }
+    }
+}
+
+// Samples the parents of the nodes in the bitmask nodes given the layering,
+// replacing their parent sets in dag. The probability of the sampled parent
+// sets is multiplied into probability.
+template <class T>
+void resample_parents_ns(int size, const std::vector<int>& layering,
+	const std::vector<std::vector<T>>& weights, int nodes, std::vector<int>& dag, T& probability) {
 	/*
 	Section 3.2.
 	*/
 
-
-    std::vector<int> dag(size, 0);
-
     int U = 0;
     U = U|layering[1];
 
     int previous_partition = U;
 
     for(int j = 2; j < (int) layering.size(); j ++) {
-        std::bitset<32> layer_bits(layering[j]);
+        std::bitset<32> layer_bits(layering[j] & nodes);
         for(int p = 0; p < size; p++) {
             if(layer_bits[p] == 0) {
                 continue;
@@ -234,6 +313,8 @@ std::vector<int> sample_parents_ns(int size, const std::vector<int>& layering,
                 if((G&previous_partition) != 0) {
                     cumulative = cumulative + weights[node][G];
                     if(cumulative > random) {
+                        probability = probability*(weights[node][G]/upper_bound);
+                        dag[node] = 0;
                         std::bitset<32> parent_bits(G);
                         for (int i = 0; i < size; i++) {
                             if(parent_bits[i] == 1) {
@@ -248,38 +329,282 @@ std::vector<int> sample_parents_ns(int size, const std::vector<int>& layering,
         previous_partition = layering[j];
         U = U|previous_partition;
     }
+}
+
+template <class T>
+std::vector<int> sample_parents_ns(int size, const std::vector<int>& layering,
+	const std::vector<std::vector<T>>& weights) {
 
+    std::vector<int> dag(size, 0);
+    T probability = T::one();
+    resample_parents_ns<T>(size, layering, weights, ((size_t)1 << size)-1, dag, probability);
     return dag;
 }
 
 }
 
-template <class T>
+// The tables are stored as type Stored, e.g. LogFloat to halve their memory usage
+// at the cost of the error bounded by storage_error_bound().
+template <class T, class Stored = T>
 class NonSymmetricSampler {
 public:
     typedef std::vector<std::vector<T>> WeightT;
 
-    NonSymmetricSampler(WeightT weights) : weights(std::move(weights)) {
-        preprocess();
+    // If table_dir is nonempty, the tables are stored in files in that
+    // directory, and the OS pages them in and out of memory as needed. The
+    // progress of the precomputation is then also saved in the directory
+    // (see Checkpoint), and if resume is set, the precomputation continues
+    // from the saved progress. Only the DAGs whose layering satisfies the
+    // layer ordering earlier (see Constraints::layer_order) are sampled.
+    NonSymmetricSampler(WeightT weights, std::string table_dir = "", bool resume = false, std::vector<int> earlier = {}) :
+        weights(std::move(weights)),
+        table_dir(std::move(table_dir)),
+        earlier(std::move(earlier))
+    {
+        preprocess(resume);
     }
 
     std::vector<int> sample() const {
         using namespace nonsymmetric_;
 
-        std::vector<int> layering = sample_layering<T>(weights.size(), h, non_symmetric_fs2);
+        std::vector<int> layering = sample_layering<T, Stored>(weights.size(), h, non_symmetric_fs2);
         return sample_parents_ns<T>(weights.size(), layering, weights);
     }
 
+    // Samples count DAGs together, see batch.h. The DAGs are independent
+    // and have the same distribution as the DAGs returned by sample().
+    std::vector<std::vector<int>> sample_batch(size_t count) const {
+        return batch_::sample_batch<T>(weights.size(), weights, h, non_symmetric_fs2, count);
+    }
+
+    int size() const {
+        return weights.size();
+    }
+
+    // Spreads the tables evenly over the NUMA nodes, see numa_interleave.
+    void interleave_tables(const std::vector<int>& nodes) const {
+        for(const HatWeightTable<T, Stored>& table : h) {
+            table.interleave(nodes);
+        }
+        non_symmetric_fs2.interleave(nodes);
+    }
+
+    /*
+    Conditional sampling for local moves, e.g. as MCMC proposals. Both are
+    Gibbs moves: the returned DAG is sampled from the DAG distribution
+    conditioned on the kept part of dag, so a Metropolis-Hastings move
+    targeting the DAG distribution always accepts it. log_probability is set
+    to the logarithm of the conditional probability of the returned DAG.
+    */
+
+    // Keeps the first prefix_length layers of the layering of dag (see
+    // dag_layering) and the parents of their nodes, and samples the rest.
+    std::vector<int> sample_from_prefix(const std::vector<int>& dag, int prefix_length, double& log_probability) const {
+        using namespace nonsymmetric_;
+
+        std::vector<int> layering = dag_layering(dag);
+        assert(dag.size() == weights.size() && !layering.empty());
+        assert(prefix_length >= 0 && prefix_length < (int)layering.size());
+        layering.resize(prefix_length + 1);
+
+        int kept = 0;
+        for(int j = 1; j <= prefix_length; ++j) {
+            kept |= layering[j];
+        }
+
+        T probability = T::one();
+        extend_layering<T, Stored>(weights.size(), h, non_symmetric_fs2, layering, probability);
+
+        std::vector<int> ret(weights.size(), 0);
+        for(int i = 0; i < (int)weights.size(); ++i) {
+            if(kept & (1 << i)) {
+                ret[i] = dag[i];
+            }
+        }
+        resample_parents_ns<T>(weights.size(), layering, weights, ~kept, ret, probability);
+
+        log_probability = probability.to_log();
+        return ret;
+    }
+
+    // Keeps the layering of dag and the parents of the other nodes, and
+    // samples the parents of the nodes in the bitmask nodes.
+    std::vector<int> resample_parents(std::vector<int> dag, int nodes, double& log_probability) const {
+        using namespace nonsymmetric_;
+
+        std::vector<int> layering = dag_layering(dag);
+        assert(dag.size() == weights.size() && !layering.empty());
+
+        T probability = T::one();
+        resample_parents_ns<T>(weights.size(), layering, weights, nodes, dag, probability);
+
+        log_probability = probability.to_log();
+        return dag;
+    }
+
+    // Table entries, for comparing engines
+    T hat_weight_entry(int node, int R, int U) const {
+        return h[node](R, U);
+    }
+    T fs_entry(int R, int U) const {
+        return non_symmetric_fs2(R, U);
+    }
+
+    // Total weight of all DAGs, i.e. the normalizing constant of the distribution.
+    T total_weight() const {
+        int V = ((size_t)1 << weights.size())-1;
+        T total = T::zero();
+        for(int R = 0; (R=(R-V)&V);) {
+            T product = non_symmetric_fs2(R, V);
+            for(int bits = R; bits; bits &= bits - 1) {
+                product = product*h[__builtin_ctz(bits)](0, 0);
+            }
+            total = total + product;
+        }
+        return total;
+    }
+
+    /*
+    Returns d such that the probability of each DAG under this sampler is
+    within a factor of exp(+-d) from the exact probability, when only the
+    rounding in storing the table entries as Stored is considered.
+
+    Let e = storage_roundoff<Stored>() * M, where M bounds the absolute values of the
+    logarithms of the stored entries. Every stored entry adds a logarithmic
+    error of at most e. The hat weights hw(0, t) and hw({k}, t) are sums of
+    exact weights, stored once, and the other hat weights hw(R, t) are sums of
+    the stored hw(R \ {k}, t) and a singleton (see calculate_node_hat_weights),
+    stored once more, so by induction over |R| their error is at most
+    |R|e <= ne. By induction over |U\S_0|, the error of fs(S_0, U) is at most
+    (n + 1)e|U\S_0|, as a sum of products of |S_1| >= 1 hat weights and
+    fs(S_1, U\S_0), stored once more. In a step of sample_layering with the
+    remaining nodes U, the weight of each choice R thus has error at most
+    (n + 1)e|U| and its probability 2(n + 1)e|U|. The remaining sets shrink by
+    at least one node per step, giving d = n(n + 1)^2 e; parent sets are
+    sampled from the exact weights.
+
+    The weights should be normalized (see normalize_weights) to keep M small.
+    */
+    double storage_error_bound() const {
+        double max_log = 0.0;
+        auto update = [&](const Stored& entry) {
+            double log_value = T(entry).to_log();
+            if(std::isfinite(log_value)) {
+                max_log = std::max(max_log, std::fabs(log_value));
+            }
+        };
+        for(const HatWeightTable<T, Stored>& table : h) {
+            table.for_each(update);
+        }
+        non_symmetric_fs2.for_each(update);
+
+        double n = weights.size();
+        return n * (n + 1.0) * (n + 1.0) * storage_roundoff<Stored>() * max_log;
+    }
+
+    // Replaces the weights of a single node, see the overload below.
+    void update_weights(int node, std::vector<T> new_weights) {
+        std::map<int, std::vector<T>> updates;
+        updates[node] = std::move(new_weights);
+        update_weights(std::move(updates));
+    }
+
+    // Replaces the weights of the given nodes, rebuilding only their hat
+    // weights and the fs entries that depend on them. Nodes whose weights do
+    // not change are skipped, and if no weights change, nothing is recomputed.
+    // With a table_dir, the directory stays locked for the whole update (see
+    // Checkpoint), and the rebuilt tables are written to new files that only
+    // replace the old ones once all of them are done. The saved progress
+    // does not match any model until then.
+    void update_weights(std::map<int, std::vector<T>> updates) {
+        using namespace nonsymmetric_;
+
+        int changed = 0;
+        for(auto& update : updates) {
+            int node = update.first;
+            assert(node >= 0 && node < (int)weights.size());
+            assert(update.second.size() == weights[node].size());
+
+            if(update.second != weights[node]) {
+                weights[node] = std::move(update.second);
+                changed |= 1 << node;
+            }
+        }
+        if(!changed) {
+            return;
+        }
+
+        // Saves the progress of the new model with nothing done
+        std::unique_ptr<Checkpoint> checkpoint;
+        if(!table_dir.empty()) {
+            checkpoint.reset(new Checkpoint(table_dir, fingerprint(), weights.size(), false));
+        }
+
+        for(int node = 0; node < (int)weights.size(); ++node) {
+            if(changed & (1 << node)) {
+                h[node] = calculate_node_hat_weights<T, Stored>(weights.size(), node, weights[node], hat_weight_path(table_dir, node));
+            }
+        }
+        if(!table_dir.empty()) {
+            // The unchanged entries are copied to the new file
+            non_symmetric_fs2 = SubTable<T, Stored>(non_symmetric_fs2, fs_path(table_dir));
+        }
+        monotone_calculate_fs<T, Stored>(weights.size(), h, non_symmetric_fs2, changed, nullptr, earlier);
+
+        for(int node = 0; node < (int)weights.size(); ++node) {
+            if(changed & (1 << node)) {
+                h[node].finish();
+            }
+        }
+        non_symmetric_fs2.finish();
+        if(checkpoint) {
+            checkpoint->finish_all();
+        }
+    }
+
 private:
-    int size;
     WeightT weights;
-    std::vector<SubTable<T>> h;
-    SubTable<T> non_symmetric_fs2;
+    std::string table_dir;
+    std::vector<int> earlier;
+    std::vector<HatWeightTable<T, Stored>> h;
+    SubTable<T, Stored> non_symmetric_fs2;
 
-    void preprocess() {
+    void preprocess(bool resume) {
         using namespace nonsymmetric_;
 
-        h = calculate_hat_weights<T>(weights.size(), weights);
-        non_symmetric_fs2 = monotone_calculate_fs<T>(weights.size(), h);
+        std::unique_ptr<Checkpoint> checkpoint;
+        if(!table_dir.empty()) {
+            checkpoint.reset(new Checkpoint(table_dir, fingerprint(), weights.size(), resume));
+        }
+
+        h = calculate_hat_weights<T, Stored>(weights.size(), weights, table_dir, checkpoint.get());
+        non_symmetric_fs2 = monotone_calculate_fs<T, Stored>(weights.size(), h, fs_path(table_dir), checkpoint.get(), earlier);
+    }
+
+    // Hash of the weights, the layer ordering and the table entry size, to
+    // check that saved tables belong to the same model.
+    std::string fingerprint() const {
+        uint64_t hash = 14695981039346656037ULL;
+        auto add = [&](const void* bytes, size_t count) {
+            for(size_t k = 0; k < count; ++k) {
+                hash = (hash ^ ((const unsigned char*)bytes)[k]) * 1099511628211ULL;
+            }
+        };
+        uint64_t entry_size = sizeof(Stored);
+        add(&entry_size, sizeof(entry_size));
+        for(const std::vector<T>& node_weights : weights) {
+            uint64_t count = node_weights.size();
+            add(&count, sizeof(count));
+            for(const T& weight : node_weights) {
+                double log_value = weight.to_log();
+                add(&log_value, sizeof(log_value));
+            }
+        }
+        for(int nodes : earlier) {
+            add(&nodes, sizeof(nodes));
+        }
+        std::ostringstream ss;
+        ss << std::hex << hash;
+        return ss.str();
     }
 };
@@ -0,0 +1,96 @@
+#include "numa.h"
+
+#include <cerrno>
+#include <cstring>
+#include <sched.h>
+#include <sstream>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+
+// From linux/mempolicy.h
+const int MPOL_INTERLEAVE_POLICY = 3;
+const unsigned MPOL_MF_MOVE_PAGES = 1 << 1;
+
+// Parses a list of CPUs or nodes such as "0-3,8-11"
+std::vector<int> parse_list(const std::string& list) {
+    std::vector<int> ret;
+    std::stringstream ss(list);
+    std::string range;
+    while(std::getline(ss, range, ',')) {
+        if(range.empty()) {
+            continue;
+        }
+        size_t dash = range.find('-');
+        int first = std::stoi(range.substr(0, dash));
+        int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+        for(int cpu = first; cpu <= last; ++cpu) {
+            ret.push_back(cpu);
+        }
+    }
+    return ret;
+}
+
+}
+
+NumaTopology NumaTopology::detect() {
+    NumaTopology topology;
+
+    std::ifstream online_fp("/sys/devices/system/node/online");
+    std::string online;
+    std::getline(online_fp, online);
+    for(int node : parse_list(online)) {
+        std::ifstream fp("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        std::string list;
+        std::getline(fp, list);
+        std::vector<int> cpus = parse_list(list);
+        if(!cpus.empty()) {
+            topology.nodes.push_back(node);
+            topology.cpus.push_back(std::move(cpus));
+        }
+    }
+
+    if(topology.nodes.empty()) {
+        topology.nodes.push_back(0);
+        topology.cpus.emplace_back();
+        for(int cpu = 0; cpu < (int)std::thread::hardware_concurrency(); ++cpu) {
+            topology.cpus.back().push_back(cpu);
+        }
+    }
+    return topology;
+}
+
+void numa_interleave(const void* ptr, size_t bytes, const std::vector<int>& nodes) {
+    if(nodes.size() < 2) {
+        return;
+    }
+
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t begin = ((uintptr_t)ptr + page_size - 1) / page_size * page_size;
+    uintptr_t end = ((uintptr_t)ptr + bytes) / page_size * page_size;
+    if(begin >= end) {
+        return;
+    }
+
+    const int bits = 8 * sizeof(unsigned long);
+    std::vector<unsigned long> mask(1024 / bits, 0);
+    for(int node : nodes) {
+        mask[node / bits] |= 1UL << (node % bits);
+    }
+    if(syscall(SYS_mbind, begin, end - begin, MPOL_INTERLEAVE_POLICY, mask.data(), (unsigned long)mask.size() * bits, MPOL_MF_MOVE_PAGES) != 0) {
+        std::cerr << "Warning: could not interleave memory over NUMA nodes: " << strerror(errno) << "\n";
+    }
+}
+
+void pin_thread_to_node(const NumaTopology& topology, int idx) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(int cpu : topology.cpus[idx]) {
+        CPU_SET(cpu, &set);
+    }
+    if(sched_setaffinity(0, sizeof(set), &set) != 0) {
+        std::cerr << "Warning: could not pin thread to NUMA node " << topology.nodes[idx] << ": " << strerror(errno) << "\n";
+    }
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "common.h"
+
+// NUMA nodes of the machine and their CPUs, read from /sys. On machines
+// without NUMA information, there is a single node 0 with all CPUs.
+struct NumaTopology {
+    std::vector<int> nodes;
+    // cpus[idx]: the CPUs of nodes[idx]
+    std::vector<std::vector<int>> cpus;
+
+    static NumaTopology detect();
+};
+
+// Spreads the pages of the memory range evenly over the given nodes, also
+// moving the pages that have already been allocated. Only the whole pages
+// within the range are affected. Does nothing if there is only one node, and
+// prints a warning if the kernel refuses.
+void numa_interleave(const void* ptr, size_t bytes, const std::vector<int>& nodes);
+
+// Restricts the calling thread to the CPUs of topology.nodes[idx]. Memory
+// that the thread touches first is then allocated from that node.
+void pin_thread_to_node(const NumaTopology& topology, int idx);
@@ -0,0 +1,347 @@
+#include "planner.h"
+#include "fixed.h"
+#include "maxlognum.h"
+#include "nonsymmetric.h"
+#include "numa.h"
+
+#include <dirent.h>
+#include <iomanip>
+#include <sched.h>
+#include <sstream>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <thread>
+
+namespace {
+
+const char* ENGINE_NAMES[ENGINE_COUNT] = {"fixed", "dense", "float", "disk", "disk-float"};
+
+// Reads a number from the first line of the file, returning false if there is none.
+bool read_number(const std::string& path, uint64_t& value) {
+    std::ifstream fp(path);
+    return (bool)(fp >> value);
+}
+
+uint64_t available_memory() {
+    uint64_t memory = 0;
+    std::ifstream fp("/proc/meminfo");
+    std::string key;
+    uint64_t kilobytes;
+    std::string unit;
+    while(fp >> key >> kilobytes >> unit) {
+        if(key == "MemAvailable:") {
+            memory = kilobytes * 1024;
+            break;
+        }
+    }
+
+    // Memory limit of the cgroup (v2), e.g. of a batch job; "max" means no limit
+    uint64_t limit, current;
+    if(read_number("/sys/fs/cgroup/memory.max", limit) && read_number("/sys/fs/cgroup/memory.current", current)) {
+        uint64_t room = limit > current ? limit - current : 0;
+        memory = memory ? std::min(memory, room) : room;
+    }
+    return memory;
+}
+
+// Free space in the directory, or 0 if it cannot be accessed.
+uint64_t free_disk_space(const std::string& dir) {
+    struct statvfs stats;
+    if(statvfs(dir.c_str(), &stats) != 0) {
+        return 0;
+    }
+    return (uint64_t)stats.f_bavail * stats.f_frsize;
+}
+
+// Total size of the table files in the directory
+uint64_t table_file_bytes(const std::string& dir) {
+    uint64_t bytes = 0;
+    DIR* handle = opendir(dir.c_str());
+    if(!handle) {
+        return 0;
+    }
+    while(dirent* entry = readdir(handle)) {
+        std::string name = entry->d_name;
+        struct stat file_stats;
+        if(name.size() > 4 && name.compare(name.size() - 4, 4, ".tbl") == 0 && stat((dir + "/" + name).c_str(), &file_stats) == 0) {
+            bytes += file_stats.st_size;
+        }
+    }
+    closedir(handle);
+    return bytes;
+}
+
+// The n + 1 tables of 3^n entries
+uint64_t table_bytes(int size, size_t entry_bytes) {
+    return (uint64_t)(size + 1) * (uint64_t)std::pow(3.0, size) * entry_bytes;
+}
+
+// Memory of a sampled DAG kept until the output, including the allocator overhead
+uint64_t dag_bytes(int size) {
+    return sizeof(std::vector<int>) + 16 * ((size * sizeof(int) + 8 + 15) / 16);
+}
+
+// The work of computing the hat weights and fs of a model with n nodes, in
+// units proportional to the running time (see also Checkpoint::work_done).
+struct Work {
+    double hat_weights;
+    double fs;
+};
+
+Work generic_work(int size) {
+    double n = size;
+    return {n * 2.0 * n * std::pow(3.0, n - 1.0), n * (std::pow(4.0, n) - 1.0)};
+}
+
+// The subset-sum transforms and the recursion of fixed_::calculate_node_hat_weights
+Work fixed_work(int size) {
+    double n = size;
+    return {n * (std::pow(3.0, n - 1.0) + n * n * std::pow(2.0, n)), std::pow(4.0, n)};
+}
+
+class Timer {
+public:
+    Timer() : last(std::chrono::steady_clock::now()) {}
+
+    // Seconds since the construction or the previous call
+    double lap() {
+        auto now = std::chrono::steady_clock::now();
+        double seconds = std::chrono::duration<double>(now - last).count();
+        last = now;
+        return seconds;
+    }
+
+private:
+    std::chrono::steady_clock::time_point last;
+};
+
+// Times of the hat weights and fs of the generic engine with the given table storage
+template <class Stored>
+Work time_generic(const std::vector<std::vector<Lognum>>& weights) {
+    using namespace nonsymmetric_;
+    const int size = ResourcePlan::CALIBRATION_SIZE;
+
+    Timer timer;
+    std::vector<HatWeightTable<Lognum, Stored>> hws = calculate_hat_weights<Lognum, Stored>(size, weights);
+    double hat_weights = timer.lap();
+    SubTable<Lognum, Stored> fs = monotone_calculate_fs<Lognum, Stored>(size, hws);
+    return {hat_weights, timer.lap()};
+}
+
+Work time_fixed(const std::vector<std::vector<Lognum>>& weights) {
+    using namespace fixed_;
+    const int size = ResourcePlan::CALIBRATION_SIZE;
+
+    Timer timer;
+    std::vector<FixedSubTable<Lognum, size>> hws(size);
+    for(int i = 0; i < size; ++i) {
+        calculate_node_hat_weights<Lognum, size>(i, weights[i], hws[i]);
+    }
+    double hat_weights = timer.lap();
+    FixedSubTable<Lognum, size> fs;
+    calculate_fs<Lognum, size>(hws, fs);
+    return {hat_weights, timer.lap()};
+}
+
+// Scales the times measured for the calibration model to a model with n nodes.
+double scale_time(const Work& measured, const Work& calibration_work, const Work& work) {
+    return measured.hat_weights * work.hat_weights / calibration_work.hat_weights + measured.fs * work.fs / calibration_work.fs;
+}
+
+std::string format_bytes(uint64_t bytes) {
+    const char* units[] = {"B", "KiB", "MiB", "GiB", "TiB", "PiB", "EiB"};
+    double value = bytes;
+    int unit = 0;
+    while(value >= 1024.0 && unit < 6) {
+        value /= 1024.0;
+        ++unit;
+    }
+    std::ostringstream ss;
+    ss << std::setprecision(3) << value << " " << units[unit];
+    return ss.str();
+}
+
+std::string format_seconds(double seconds) {
+    if(seconds < 0.0) {
+        return "-";
+    }
+    std::ostringstream ss;
+    ss << std::setprecision(3);
+    if(seconds < 120.0) {
+        ss << seconds << "s";
+    } else if(seconds < 7200.0) {
+        ss << seconds / 60.0 << "min";
+    } else if(seconds < 172800.0) {
+        ss << seconds / 3600.0 << "h";
+    } else {
+        ss << seconds / 86400.0 << "d";
+    }
+    return ss.str();
+}
+
+}
+
+const char* engine_name(Engine engine) {
+    return ENGINE_NAMES[engine];
+}
+
+bool parse_engine(const std::string& name, Engine& engine) {
+    for(int idx = 0; idx < ENGINE_COUNT; ++idx) {
+        if(name == ENGINE_NAMES[idx]) {
+            engine = (Engine)idx;
+            return true;
+        }
+    }
+    return false;
+}
+
+MachineResources MachineResources::detect(const std::string& table_dir) {
+    MachineResources machine;
+    machine.memory = available_memory();
+    machine.disk = table_dir.empty() ? 0 : free_disk_space(table_dir);
+
+    cpu_set_t cpus;
+    machine.cores = sched_getaffinity(0, sizeof(cpus), &cpus) == 0 ? CPU_COUNT(&cpus) : (int)std::thread::hardware_concurrency();
+    machine.numa_nodes = NumaTopology::detect().nodes.size();
+    return machine;
+}
+
+ModelSummary summarize_symmetric_weights(const std::vector<Lognum>& weights) {
+    int size = weights.size();
+    ModelSummary summary = {size, 0, 0};
+    double binomial = 1.0;
+    for(int k = 0; k < size; ++k) {
+        if(weights[k] > Lognum::zero()) {
+            summary.parent_sets += size * (uint64_t)std::round(binomial);
+            summary.max_in_degree = k;
+        }
+        binomial = binomial * (size - 1 - k) / (k + 1);
+    }
+    return summary;
+}
+
+ResourcePlan::ResourcePlan(const ModelSummary& model, PlanSettings settings) :
+    model(model),
+    settings(std::move(settings)),
+    resources(MachineResources::detect(this->settings.table_dir))
+{
+    int size = model.size;
+    resources.memory /= std::max(this->settings.concurrent_models, 1);
+    if(this->settings.memory_limit) {
+        resources.memory = std::min(resources.memory, this->settings.memory_limit);
+    }
+    if(this->settings.resume) {
+        resources.disk += table_file_bytes(this->settings.table_dir);
+    }
+
+    // The weights, which are kept until the end
+    uint64_t weight_memory = (uint64_t)size * ((uint64_t)1 << size) * sizeof(Lognum);
+    // The maximum weight DAG is found first, and its tables and weights are freed before the precomputation.
+    uint64_t map_memory = 0;
+    if(this->settings.map) {
+        map_memory = table_bytes(size, sizeof(MaxLognum)) + ((uint64_t)size + 1) * ((uint64_t)1 << size) * sizeof(MaxLognum);
+    }
+    uint64_t sample_memory = this->settings.stored_dags * dag_bytes(size);
+
+    for(int idx = 0; idx < ENGINE_COUNT; ++idx) {
+        EngineEstimate estimate;
+        estimate.engine = (Engine)idx;
+        estimate.seconds = -1.0;
+
+        uint64_t tables = table_bytes(size, engine_uses_float(estimate.engine) ? sizeof(LogFloat) : sizeof(Lognum));
+        // Sums over subsets computed for one node at a time
+        uint64_t temporary = ((estimate.engine == ENGINE_FIXED ? size : 0) + 1) * ((uint64_t)1 << size) * sizeof(Lognum);
+        uint64_t copies = this->settings.replicate ? resources.numa_nodes * tables : 0;
+        if(engine_uses_disk(estimate.engine)) {
+            estimate.memory = temporary + copies;
+            estimate.disk = tables;
+        } else {
+            estimate.memory = tables + temporary + copies;
+            estimate.disk = 0;
+        }
+        estimate.memory = weight_memory + std::max(estimate.memory + sample_memory, map_memory);
+
+        if(estimate.engine == ENGINE_FIXED && size > fixed_::MAX_SIZE) {
+            estimate.unavailable = "more than " + std::to_string(fixed_::MAX_SIZE) + " nodes";
+        } else if(engine_uses_disk(estimate.engine) && this->settings.table_dir.empty()) {
+            estimate.unavailable = "no table directory";
+        }
+        estimates.push_back(estimate);
+    }
+}
+
+void ResourcePlan::estimate_times() {
+    const int calibration_size = CALIBRATION_SIZE;
+
+    // A random model with all parent sets of positive weight, so that no hat
+    // weights are skipped. The random numbers of the samples are not used.
+    std::mt19937 gen(1);
+    std::uniform_real_distribution<double> log_weight(-10.0, 0.0);
+    std::vector<std::vector<Lognum>> weights(calibration_size, std::vector<Lognum>((size_t)1 << calibration_size, Lognum::zero()));
+    for(int i = 0; i < calibration_size; ++i) {
+        for(uint32_t S = 0; S < weights[i].size(); ++S) {
+            if(!(S & ((uint32_t)1 << i))) {
+                weights[i][S] = Lognum::from_log(log_weight(gen));
+            }
+        }
+    }
+
+    Work generic = generic_work(model.size);
+    Work generic_calibration = generic_work(calibration_size);
+    double dense_seconds = scale_time(time_generic<Lognum>(weights), generic_calibration, generic);
+    double float_seconds = scale_time(time_generic<LogFloat>(weights), generic_calibration, generic);
+    double fixed_seconds = scale_time(time_fixed(weights), fixed_work(calibration_size), fixed_work(model.size));
+
+    // The disk engines compute the same, with the tables mapped from their files.
+    estimates[ENGINE_FIXED].seconds = fixed_seconds;
+    estimates[ENGINE_DENSE].seconds = dense_seconds;
+    estimates[ENGINE_FLOAT].seconds = float_seconds;
+    estimates[ENGINE_DISK].seconds = dense_seconds;
+    estimates[ENGINE_DISK_FLOAT].seconds = float_seconds;
+}
+
+int ResourcePlan::choose(const std::vector<Engine>& candidates) const {
+    for(Engine engine : candidates) {
+        if(estimates[engine].fits(resources)) {
+            return engine;
+        }
+    }
+    return -1;
+}
+
+void ResourcePlan::write_report(std::ostream& out, int chosen) const {
+    out << "Model: " << model.size << " nodes, " << model.parent_sets << " parent sets of positive weight, largest in-degree "
+        << model.max_in_degree << "\n";
+    out << "Machine: " << format_bytes(resources.memory) << " of memory available";
+    if(settings.concurrent_models > 1) {
+        out << " to each of " << settings.concurrent_models << " concurrent models";
+    }
+    out << ", " << resources.cores << " cores, " << resources.numa_nodes << " NUMA nodes";
+    if(!settings.table_dir.empty()) {
+        out << ", " << format_bytes(resources.disk) << " of disk space for " << settings.table_dir;
+    }
+    out << "\n";
+
+    out << std::left << std::setw(12) << "engine" << std::right << std::setw(14) << "memory" << std::setw(14) << "disk"
+        << std::setw(16) << "precomputation" << "  result\n";
+    for(const EngineEstimate& estimate : estimates) {
+        out << std::left << std::setw(12) << engine_name(estimate.engine) << std::right;
+        if(!estimate.unavailable.empty()) {
+            out << std::setw(14) << "-" << std::setw(14) << "-" << std::setw(16) << "-" << "  unavailable: " << estimate.unavailable << "\n";
+            continue;
+        }
+        out << std::setw(14) << format_bytes(estimate.memory) << std::setw(14) << format_bytes(estimate.disk)
+            << std::setw(16) << format_seconds(estimate.seconds) << "  ";
+        if(estimate.engine == chosen) {
+            out << "chosen";
+        } else if(estimate.fits(resources)) {
+            out << "fits";
+        } else {
+            out << "too large";
+        }
+        if(engine_uses_disk(estimate.engine) && estimate.disk > resources.memory) {
+            out << " (tables exceed the memory, the precomputation will page them from disk)";
+        }
+        out << "\n";
+    }
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include "common.h"
+#include "lognum.h"
+
+/*
+    Pre-flight resource planning for the nonsymmetric sampling engines. Before
+    the precomputation starts, the memory, disk space and time that each engine
+    needs for a model are estimated and compared with the resources of the
+    machine, so that a model too large for the machine fails at once instead
+    of running out of memory partway through the precomputation. The engines are
+
+    - fixed: FixedNonSymmetricSampler, for at most fixed_::MAX_SIZE nodes,
+    - dense: NonSymmetricSampler<Lognum>,
+    - float: NonSymmetricSampler<Lognum, LogFloat>, whose tables take half
+      the memory at the cost of a small storage error,
+    - disk and disk-float: dense and float with the tables stored in files in
+      the table directory, which the OS pages in and out of memory as needed.
+
+    Every engine stores the n + 1 tables of 3^n entries and the weights of
+    all n 2^(n-1) parent sets densely, so the estimates only depend on the
+    number of nodes; the number of parent sets and the largest in-degree of
+    the model are reported, but they do not make the tables smaller. The plan
+    is made from a ModelSummary, which can be read from a weight file without
+    allocating the weights (see read_nonsymmetric_summary).
+*/
+
+enum Engine {
+    ENGINE_FIXED,
+    ENGINE_DENSE,
+    ENGINE_FLOAT,
+    ENGINE_DISK,
+    ENGINE_DISK_FLOAT
+};
+const int ENGINE_COUNT = 5;
+
+const char* engine_name(Engine engine);
+// Returns false if there is no engine with the name.
+bool parse_engine(const std::string& name, Engine& engine);
+
+inline bool engine_uses_float(Engine engine) {
+    return engine == ENGINE_FLOAT || engine == ENGINE_DISK_FLOAT;
+}
+inline bool engine_uses_disk(Engine engine) {
+    return engine == ENGINE_DISK || engine == ENGINE_DISK_FLOAT;
+}
+
+struct ModelSummary {
+    int size;
+    // Number of parent sets of positive weight, and the largest in-degree among them
+    uint64_t parent_sets;
+    int max_in_degree;
+};
+
+// Summary of the nonsymmetric model given by symmetric weights
+ModelSummary summarize_symmetric_weights(const std::vector<Lognum>& weights);
+
+// Resources of the machine available to the sampler.
+struct MachineResources {
+    // MemAvailable of /proc/meminfo, or the room left below the memory limit
+    // of the cgroup of the process if that is smaller.
+    uint64_t memory;
+    // Free space in the table directory, or 0 if there is none.
+    uint64_t disk;
+    int cores;
+    int numa_nodes;
+
+    static MachineResources detect(const std::string& table_dir);
+};
+
+// What the run does besides the precomputation, as far as it needs memory or disk space.
+struct PlanSettings {
+    std::string table_dir;
+    // Table files left in table_dir by an earlier run are reused or replaced,
+    // so their space counts as free.
+    bool resume = false;
+    // The maximum weight DAG is found with dense tables before the precomputation.
+    bool map = false;
+    // The tables are copied to each NUMA node for sampling.
+    bool replicate = false;
+    // Number of DAGs kept in memory until the output is written.
+    uint64_t stored_dags = 0;
+    // Number of models sampled at the same time (in batch mode), which share
+    // the memory of the machine evenly.
+    int concurrent_models = 1;
+    // If nonzero, the memory available to each model is at most this.
+    uint64_t memory_limit = 0;
+};
+
+struct EngineEstimate {
+    Engine engine;
+    // Empty if the engine can run the model, otherwise the reason why not.
+    std::string unavailable;
+    // Peak memory allocated by the run and the total size of the table files
+    uint64_t memory;
+    uint64_t disk;
+    // Estimated precomputation time, negative if not estimated
+    double seconds;
+
+    bool fits(const MachineResources& machine) const {
+        return unavailable.empty() && memory <= machine.memory && disk <= machine.disk;
+    }
+};
+
+class ResourcePlan {
+public:
+    ResourcePlan(const ModelSummary& model, PlanSettings settings);
+
+    // Estimates the precomputation time of each engine from the time it takes
+    // for a random model of CALIBRATION_SIZE nodes. This takes a fraction of
+    // a second.
+    void estimate_times();
+    static const int CALIBRATION_SIZE = 10;
+
+    const MachineResources& machine() const {
+        return resources;
+    }
+    const EngineEstimate& estimate(Engine engine) const {
+        return estimates[engine];
+    }
+
+    // The first of the candidates that fits in the resources of the machine,
+    // or -1 if none of them does.
+    int choose(const std::vector<Engine>& candidates) const;
+
+    // Writes the model, the machine and the estimates of all engines,
+    // marking the chosen engine (or none if chosen is -1).
+    void write_report(std::ostream& out, int chosen) const;
+
+private:
+    ModelSummary model;
+    PlanSettings settings;
+    MachineResources resources;
+    std::vector<EngineEstimate> estimates;
+};
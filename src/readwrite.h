@@ -1,112 +1,337 @@
 #pragma once
 
 #include "common.h"
+#include "constraints.h"
+#include "planner.h"
+#include "statistics.h"
+
+#include <sstream>
+#include <stdexcept>
+
+// The readers of weight and constraint files throw std::runtime_error for
+// invalid files, so that one invalid model of a batch does not stop the others.
 
 template <typename T>
 std::vector<T> read_symmetric_weights(const std::string& filename) {
-    std::ifstream file;
-    file.exceptions(file.failbit | file.badbit);
-    file.open(filename);
+    try {
+        std::ifstream file;
+        file.exceptions(file.failbit | file.badbit);
+        file.open(filename);
 
-    int size;
-    file >> size;
+        int size;
+        file >> size;
 
-    if(size <= 0) {
-        std::cerr << "Invalid symmetric weight file\n";
-        exit(1);
-    }
+        if(size <= 0) {
+            throw std::runtime_error("Invalid symmetric weight file");
+        }
 
-    std::vector<T> weights(size);
-    for(int i = 0; i < size; ++i) {
-        double log_value;
-        file >> log_value;
-        weights[i] = T::from_log(log_value);
-    }
+        std::vector<T> weights(size);
+        for(int i = 0; i < size; ++i) {
+            double log_value;
+            file >> log_value;
+            weights[i] = T::from_log(log_value);
+        }
 
-    return weights;
+        return weights;
+    } catch(const std::ios_base::failure&) {
+        throw std::runtime_error("Could not read symmetric weight file " + filename);
+    }
 }
 
-template <typename T>
-std::vector<std::vector<T>> read_nonsymmetric_weights(const std::string& filename) {
-    std::ifstream file;
-    file.exceptions(file.failbit | file.badbit);
-    file.open(filename);
+inline Constraints read_constraints(const std::string& filename, const std::map<std::string, int>& name_to_idx) {
+    std::ifstream file(filename);
+    if(!file.is_open()) {
+        throw std::runtime_error(std::string("Could not open constraint file ") + filename);
+    }
 
-    int size;
-    file >> size;
+    int size = (int)name_to_idx.size();
+    Constraints constraints(size);
+    std::vector<int> tier(size, -1);
 
-    if(size <= 0) {
-        std::cerr << "Invalid nonsymmetric weight file\n";
-        exit(1);
+    auto read_node = [&]() {
+        std::string name;
+        file >> name;
+        auto it = name_to_idx.find(name);
+        if(!file || it == name_to_idx.end()) {
+            throw std::runtime_error("Invalid constraint file");
+        }
+        return it->second;
+    };
+
+    std::string keyword;
+    while(file >> keyword) {
+        if(keyword == "require" || keyword == "forbid" || keyword == "before") {
+            int first = read_node();
+            int second = read_node();
+            if(first == second) {
+                throw std::runtime_error("Invalid constraint file");
+            }
+            if(keyword == "require") {
+                constraints.required[second] |= 1 << first;
+            } else if(keyword == "forbid") {
+                constraints.forbidden[second] |= 1 << first;
+            } else {
+                constraints.earlier[second] |= 1 << first;
+            }
+        } else if(keyword == "tier") {
+            int level, count;
+            file >> level >> count;
+            if(!file || level < 0 || count < 0) {
+                throw std::runtime_error("Invalid constraint file");
+            }
+            for(int k = 0; k < count; ++k) {
+                tier[read_node()] = level;
+            }
+        } else {
+            throw std::runtime_error("Invalid constraint file");
+        }
     }
-    if(size >= 31) {
-        std::cerr << "Too many nodes in nonsymmetric weight file\n";
-        exit(1);
+
+    constraints.add_tiers(tier);
+    if(!constraints.consistent()) {
+        throw std::runtime_error("Inconsistent constraints");
     }
 
+    return constraints;
+}
+
+// Reads constraints for nodes that are referred to by their indices 0, ..., size - 1.
+inline Constraints read_constraints(const std::string& filename, int size) {
     std::map<std::string, int> name_to_idx;
     for(int i = 0; i < size; ++i) {
-        std::string name;
-        int score_count;
-        file >> name >> score_count;
+        name_to_idx[std::to_string(i)] = i;
+    }
+    return read_constraints(filename, name_to_idx);
+}
 
-        if(name_to_idx.count(name)) {
-            std::cerr << "Invalid nonsymmetric weight file\n";
-            exit(1);
+template <typename T>
+void apply_constraints_or_throw(std::vector<std::vector<T>>& weights, const Constraints& constraints) {
+    if(!apply_constraints(weights, constraints)) {
+        throw std::runtime_error("Constraints leave some node without a parent set of positive weight");
+    }
+}
+
+// Reads the number of nodes, the number of parent sets and the largest
+// in-degree from a nonsymmetric weight file without storing the weights, whose
+// tables take n 2^n entries.
+inline ModelSummary read_nonsymmetric_summary(const std::string& filename) {
+    try {
+        std::ifstream file;
+        file.exceptions(file.failbit | file.badbit);
+        file.open(filename);
+
+        ModelSummary summary = {0, 0, 0};
+        file >> summary.size;
+        if(summary.size <= 0) {
+            throw std::runtime_error("Invalid nonsymmetric weight file");
+        }
+        if(summary.size >= 31) {
+            throw std::runtime_error("Too many nodes in nonsymmetric weight file");
         }
-        name_to_idx[name] = i;
-
-        for(int j = 0; j < score_count; ++j) {
-            double log_score;
-            int parent_count;
-            file >> log_score >> parent_count;
-            if(parent_count < 0) {
-                std::cerr << "Invalid nonsymmetric weight file\n";
-                exit(1);
-            }
 
-            for(int k = 0; k < parent_count; ++k) {
-                std::string parent;
-                file >> parent;
+        for(int i = 0; i < summary.size; ++i) {
+            std::string name;
+            int score_count;
+            file >> name >> score_count;
+            for(int j = 0; j < score_count; ++j) {
+                double log_score;
+                int parent_count;
+                file >> log_score >> parent_count;
+                if(parent_count < 0) {
+                    throw std::runtime_error("Invalid nonsymmetric weight file");
+                }
+                for(int k = 0; k < parent_count; ++k) {
+                    std::string parent;
+                    file >> parent;
+                }
+                ++summary.parent_sets;
+                summary.max_in_degree = std::max(summary.max_in_degree, parent_count);
             }
         }
+        return summary;
+    } catch(const std::ios_base::failure&) {
+        throw std::runtime_error("Could not read nonsymmetric weight file " + filename);
     }
+}
 
-    file.seekg(0);
+// Reads the weights and applies the constraints of the constraint file, if
+// any, to them. The layer ordering of the constraints (see
+// Constraints::layer_order) is stored in layer_order, or rejected if
+// layer_order is null.
+template <typename T>
+std::vector<std::vector<T>> read_nonsymmetric_weights(const std::string& filename, const std::string& constraints_filename = "",
+    std::vector<int>* layer_order = nullptr) {
+    try {
+        std::ifstream file;
+        file.exceptions(file.failbit | file.badbit);
+        file.open(filename);
 
-    int ignore;
-    file >> ignore;
+        int size;
+        file >> size;
 
-    std::vector<std::vector<T>> weights(size);
-    for (int i = 0; i < size; ++i) {
-        weights[i].resize(1 << size, T::zero());
+        if(size <= 0) {
+            throw std::runtime_error("Invalid nonsymmetric weight file");
+        }
+        if(size >= 31) {
+            throw std::runtime_error("Too many nodes in nonsymmetric weight file");
+        }
 
-        std::string name;
-        int score_count;
-        file >> name >> score_count;
+        std::map<std::string, int> name_to_idx;
+        for(int i = 0; i < size; ++i) {
+            std::string name;
+            int score_count;
+            file >> name >> score_count;
+
+            if(name_to_idx.count(name)) {
+                throw std::runtime_error("Invalid nonsymmetric weight file");
+            }
+            name_to_idx[name] = i;
+
+            for(int j = 0; j < score_count; ++j) {
+                double log_score;
+                int parent_count;
+                file >> log_score >> parent_count;
+                if(parent_count < 0) {
+                    throw std::runtime_error("Invalid nonsymmetric weight file");
+                }
+
+                for(int k = 0; k < parent_count; ++k) {
+                    std::string parent;
+                    file >> parent;
+                }
+            }
+        }
+
+        file.seekg(0);
+
+        int ignore;
+        file >> ignore;
+
+        std::vector<std::vector<T>> weights(size);
+        for (int i = 0; i < size; ++i) {
+            weights[i].resize(1 << size, T::zero());
+
+            std::string name;
+            int score_count;
+            file >> name >> score_count;
         
-        for(int j = 0; j < score_count; ++j) {
-            double log_score;
-            int parent_count;
-            file >> log_score >> parent_count;
+            for(int j = 0; j < score_count; ++j) {
+                double log_score;
+                int parent_count;
+                file >> log_score >> parent_count;
 
-            std::bitset<32> parents;
+                std::bitset<32> parents;
 
-            for(int k = 0; k < parent_count; ++k) {
-                std::string parent;
-                file >> parent;
+                for(int k = 0; k < parent_count; ++k) {
+                    std::string parent;
+                    file >> parent;
 
-                auto it = name_to_idx.find(parent);
-                if(it == name_to_idx.end() || it->second == i) {
-                    std::cerr << "Invalid nonsymmetric weight file\n";
-                    exit(1);
+                    auto it = name_to_idx.find(parent);
+                    if(it == name_to_idx.end() || it->second == i) {
+                        throw std::runtime_error("Invalid nonsymmetric weight file");
+                    }
+                    parents[it->second] = 1;
                 }
-                parents[it->second] = 1;
+
+                weights[i][parents.to_ulong()] = T::from_log(log_score);
             }
+        }
 
-            weights[i][parents.to_ulong()] = T::from_log(log_score);
+        if(!constraints_filename.empty()) {
+            Constraints constraints = read_constraints(constraints_filename, name_to_idx);
+            apply_constraints_or_throw(weights, constraints);
+            if(layer_order) {
+                *layer_order = constraints.layer_order();
+            } else if(!constraints.layer_order().empty()) {
+                throw std::runtime_error("Layer orderings are not supported here");
+            }
         }
-    }
     
-    return weights;
+        return weights;
+    } catch(const std::ios_base::failure&) {
+        throw std::runtime_error("Could not read nonsymmetric weight file " + filename);
+    }
+}
+
+struct ManifestEntry {
+    std::string weight_file;
+    int number_of_dags;
+    uint32_t seed;
+    std::string output_file;
+};
+
+// Reads a manifest with lines of the form
+//     <weight_file> <number_of_dags> <seed> <output_file>
+// Empty lines and lines starting with # are ignored.
+inline std::vector<ManifestEntry> read_manifest(const std::string& filename) {
+    std::ifstream file(filename);
+    if(!file.is_open()) {
+        std::cerr << "Could not open manifest file " << filename << "\n";
+        exit(1);
+    }
+
+    std::vector<ManifestEntry> manifest;
+    std::string line;
+    while(std::getline(file, line)) {
+        std::istringstream fields(line);
+        std::string first;
+        if(!(fields >> first) || first[0] == '#') {
+            continue;
+        }
+
+        ManifestEntry entry;
+        entry.weight_file = first;
+        std::string extra;
+        if(!(fields >> entry.number_of_dags >> entry.seed >> entry.output_file) || fields >> extra || entry.number_of_dags < 0) {
+            std::cerr << "Invalid manifest line: " << line << "\n";
+            exit(1);
+        }
+        manifest.push_back(entry);
+    }
+
+    return manifest;
+}
+
+// Reads a sampler output file for merging. Outputs of --stats, which start
+// with a line containing only the number of samples, are added to edge_counts
+// (initialized from the first such file) and the function returns true.
+// Otherwise the lines of the file, each a sampled DAG, are appended to
+// dag_lines and the function returns false.
+inline bool read_sampler_output(const std::string& filename, std::vector<std::string>& dag_lines, EdgeCounts& edge_counts, bool first) {
+    std::ifstream file(filename);
+    if(!file.is_open()) {
+        std::cerr << "Could not open output file " << filename << "\n";
+        exit(1);
+    }
+
+    std::vector<std::string> lines;
+    std::string line;
+    while(std::getline(file, line)) {
+        lines.push_back(line);
+    }
+    if(lines.empty() || lines[0].find("<-") != std::string::npos) {
+        dag_lines.insert(dag_lines.end(), lines.begin(), lines.end());
+        return false;
+    }
+
+    EdgeCounts counts(lines.size() - 1);
+    std::istringstream header(lines[0]);
+    bool ok = (bool)(header >> counts.samples);
+    for(int i = 0; i < counts.size; ++i) {
+        std::istringstream row(lines[i + 1]);
+        for(int j = 0; j < counts.size; ++j) {
+            ok = ok && (row >> counts.counts[(size_t)i * counts.size + j]);
+        }
+    }
+    if(!ok || (!first && counts.size != edge_counts.size)) {
+        std::cerr << "Invalid edge counts in " << filename << "\n";
+        exit(1);
+    }
+
+    if(first) {
+        edge_counts = counts;
+    } else {
+        edge_counts.add(counts);
+    }
+    return true;
 }
@@ -1,67 +1,660 @@
 #include "common.h"
+#include "fixed.h"
+#include "maxlognum.h"
+#include "numa.h"
+#include "planner.h"
 #include "nonsymmetric.h"
 #include "symmetric.h"
 #include "readwrite.h"
+#include "server.h"
+#include "statistics.h"
+#include "threadpool.h"
 
-void write_dags(const std::vector<std::vector<int>>& dags) {
+#include <atomic>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+void write_dags(std::ostream& out, const std::vector<std::vector<int>>& dags) {
     for(const std::vector<int>& dag : dags) {
         int size = dag.size();
 
         for(int i = 0; i < size; ++i) {
             if(i) {
-                std::cout << ", ";
+                out << ", ";
             }
 
-            std::cout << i << " <- {";
+            out << i << " <- {";
 
             bool first = true;
             for(int j = 0; j < size; ++j) {
                 if(dag[i] & (1 << j)) {
                     if(!first) {
-                        std::cout << ", ";
+                        out << ", ";
                     }
                     first = false;
-                    std::cout << j;
+                    out << j;
                 }
             }
-            std::cout << "}";
+            out << "}";
         }
-        std::cout << "\n";
+        out << "\n";
     }
 }
 
+void write_edge_counts(std::ostream& out, const EdgeCounts& edge_counts) {
+    out << edge_counts.samples << "\n";
+    for(int i = 0; i < edge_counts.size; ++i) {
+        for(int j = 0; j < edge_counts.size; ++j) {
+            if(j) {
+                out << " ";
+            }
+            out << edge_counts.counts[(size_t)i * edge_counts.size + j];
+        }
+        out << "\n";
+    }
+}
+
+// Reports the error added by compact table storage, if any.
 template <class Sampler>
-void run_sampler(int number_of_dags, typename Sampler::WeightT weights) {
-    std::cerr << "Sampling " << number_of_dags << " DAGs\n";
+void report_storage_error(std::ostream&, const Sampler&) {}
 
-    clock_t begin = clock();
+template <class T, class S>
+void report_storage_error(std::ostream& log, const NonSymmetricSampler<T, S>& sampler) {
+    double bound = sampler.storage_error_bound();
+    if(bound > 0.0) {
+        log << "Storage error: DAG probabilities within a factor of exp(+-" << bound << ")\n";
+    }
+}
 
-    Sampler sampler(std::move(weights));
+enum NumaPlacement {
+    NUMA_NONE,
+    // The tables are spread evenly over the NUMA nodes
+    NUMA_INTERLEAVE,
+    // Each NUMA node has its own copy of the tables
+    NUMA_REPLICATE
+};
 
-    clock_t mid = clock();
-    
+struct Options {
+    std::string constraints_file;
+    bool stats = false;
+    bool single_precision = false;
+    std::string table_dir;
+    // Continue the precomputation from the progress saved in table_dir
+    bool resume = false;
+    // Nonsymmetric engine given with --engine, see planner.h. Otherwise the
+    // engine follows from single_precision and table_dir.
+    bool engine_given = false;
+    bool auto_engine = false;
+    Engine engine = ENGINE_DENSE;
+    // Write the resource plan of the nonsymmetric engines instead of sampling
+    bool plan = false;
+    // If nonzero, the planned memory of each model is limited to this many bytes
+    uint64_t max_memory = 0;
+    // If nonempty, a DAG of maximum weight is also written to this file.
+    std::string map_file;
+    // Number of DAGs sampled together by the nonsymmetric samplers, see batch.h.
+    int batch_size = 1;
+    int sampling_threads = 1;
+    NumaPlacement numa = NUMA_NONE;
+    // If shard_count > 0, only the samples in shard shard_index of shard_count
+    // are drawn, seeded by their indices (see seed_block).
+    int shard_index = 0;
+    int shard_count = 0;
+    bool seeded = false;
+    uint32_t seed = 0;
+    // If nonempty, the samples are requested from the server listening on this socket.
+    std::string socket_path;
+    int threads = ThreadPool::default_thread_count();
+    size_t cache_capacity = 16;
+};
+
+// Samplers that support storing their tables in files are constructed with
+// the table directory, and the nonsymmetric samplers with the layer ordering
+// earlier (see Constraints::layer_order), which is empty for the others.
+template <class Sampler>
+Sampler construct_sampler(const Options& options, typename Sampler::WeightT weights, const std::vector<int>& earlier, Sampler*) {
+    if(!options.table_dir.empty()) {
+        std::cerr << "Table files are only supported by the nonsymmetric sampler\n";
+        exit(1);
+    }
+    assert(earlier.empty());
+    return Sampler(std::move(weights));
+}
+
+template <class T, int N>
+FixedNonSymmetricSampler<T, N> construct_sampler(const Options&, std::vector<std::vector<T>> weights, const std::vector<int>& earlier,
+    FixedNonSymmetricSampler<T, N>*) {
+    return FixedNonSymmetricSampler<T, N>(std::move(weights), earlier);
+}
+
+template <class T, class S>
+NonSymmetricSampler<T, S> construct_sampler(const Options& options, std::vector<std::vector<T>> weights, const std::vector<int>& earlier,
+    NonSymmetricSampler<T, S>*) {
+    return NonSymmetricSampler<T, S>(std::move(weights), options.table_dir, options.resume, earlier);
+}
+
+// Spreads the tables of the sampler over the NUMA nodes, if they are large enough to matter.
+template <class Sampler>
+void interleave_tables(const Sampler&, const std::vector<int>&) {}
+
+template <class T, class S>
+void interleave_tables(const NonSymmetricSampler<T, S>& sampler, const std::vector<int>& nodes) {
+    sampler.interleave_tables(nodes);
+}
+
+template <class T, int N>
+void interleave_tables(const FixedNonSymmetricSampler<T, N>& sampler, const std::vector<int>& nodes) {
+    sampler.interleave_tables(nodes);
+}
+
+// Samples count DAGs, together if the sampler supports batched sampling.
+template <class Sampler>
+std::vector<std::vector<int>> sample_dags(const Sampler& sampler, int count) {
     std::vector<std::vector<int>> dags;
-    for (int i = 0; i < number_of_dags; ++i) {
+    for(int i = 0; i < count; ++i) {
         dags.push_back(sampler.sample());
     }
+    return dags;
+}
+
+template <class T, class S>
+std::vector<std::vector<int>> sample_dags(const NonSymmetricSampler<T, S>& sampler, int count) {
+    return count == 1 ? std::vector<std::vector<int>>{sampler.sample()} : sampler.sample_batch(count);
+}
+
+template <class T, int N>
+std::vector<std::vector<int>> sample_dags(const FixedNonSymmetricSampler<T, N>& sampler, int count) {
+    return count == 1 ? std::vector<std::vector<int>>{sampler.sample()} : sampler.sample_batch(count);
+}
+
+// When sharding, the DAGs are divided into blocks of SEED_BLOCK consecutive
+// indices, and each block is sampled with the random number generator
+// seeded by seed_block, so that the samples only depend on the seed and
+// their indices. Seeding costs more than sampling a small DAG, so it is
+// done once per block rather than once per DAG.
+const uint64_t SEED_BLOCK = 1024;
+
+void seed_block(uint32_t seed, uint64_t block) {
+    std::seed_seq seq{seed, (uint32_t)block, (uint32_t)(block >> 32)};
+    rng.seed(seq);
+}
+
+// Index of the first DAG of part k of count parts of the indices
+// [first_index, end_index), rounded down to a whole seed block. first_index
+// must be at the start of a block.
+uint64_t part_begin(uint64_t first_index, uint64_t end_index, int k, int count) {
+    if(k == count) {
+        return end_index;
+    }
+    uint64_t index = first_index + (end_index - first_index) * k / count;
+    return index - index % SEED_BLOCK;
+}
+
+// Samples DAGs and adds them to dags, or to edge_counts with --stats. When
+// sharding, the DAGs have indices first_index, first_index + 1, ..., where
+// first_index is at the start of a seed block.
+template <class Sampler>
+void sample_into(const Options& options, const Sampler& sampler, uint64_t first_index, int number_of_dags,
+    std::vector<std::vector<int>>& dags, EdgeCounts& edge_counts) {
+    assert(!options.shard_count || first_index % SEED_BLOCK == 0);
+
+    for (int i = 0; i < number_of_dags; i += options.batch_size) {
+        if(options.shard_count && (first_index + i) % SEED_BLOCK == 0) {
+            seed_block(options.seed, (first_index + i) / SEED_BLOCK);
+        }
+        for(std::vector<int>& dag : sample_dags(sampler, std::min(options.batch_size, number_of_dags - i))) {
+            if(options.stats) {
+                edge_counts.add(dag);
+            } else {
+                dags.push_back(std::move(dag));
+            }
+        }
+    }
+}
+
+// Same as sample_into, but with options.sampling_threads threads, each pinned
+// to a NUMA node in turn if a NUMA placement is given. With NUMA_REPLICATE,
+// the threads use the copy of the sampler made on their own node. Each thread
+// has its own random number generator, seeded from that of the calling
+// thread, and the DAGs are output in the order of the threads. When sharding,
+// the threads sample whole seed blocks instead.
+template <class Sampler>
+void sample_parallel(const Options& options, const Sampler& sampler, uint64_t first_index, int number_of_dags,
+    std::vector<std::vector<int>>& dags, EdgeCounts& edge_counts) {
+    NumaTopology topology = NumaTopology::detect();
+    int node_count = topology.nodes.size();
+
+    if(options.numa == NUMA_INTERLEAVE) {
+        interleave_tables(sampler, topology.nodes);
+    }
+
+    // The copy on each node is made by a thread pinned to that node, so that its memory is allocated there
+    std::vector<std::unique_ptr<Sampler>> replicas;
+    if(options.numa == NUMA_REPLICATE) {
+        replicas.resize(node_count);
+        std::vector<std::thread> threads;
+        for(int idx = 0; idx < node_count; ++idx) {
+            threads.emplace_back([&, idx]() {
+                pin_thread_to_node(topology, idx);
+                replicas[idx].reset(new Sampler(sampler));
+            });
+        }
+        for(std::thread& thread : threads) {
+            thread.join();
+        }
+    }
+
+    int thread_count = options.sampling_threads;
+    std::vector<uint32_t> seeds;
+    for(int k = 0; k < thread_count; ++k) {
+        seeds.push_back(rng());
+    }
+
+    std::vector<std::vector<std::vector<int>>> thread_dags(thread_count);
+    std::vector<EdgeCounts> thread_edge_counts(thread_count, EdgeCounts(sampler.size()));
+    std::vector<std::thread> threads;
+    uint64_t thread_first_index = first_index;
+    for(int k = 0; k < thread_count; ++k) {
+        int count = number_of_dags / thread_count + (k < number_of_dags % thread_count);
+        if(options.shard_count) {
+            count = part_begin(first_index, first_index + number_of_dags, k + 1, thread_count) - thread_first_index;
+        }
+        threads.emplace_back([&, k, count, thread_first_index]() {
+            if(options.numa != NUMA_NONE) {
+                pin_thread_to_node(topology, k % node_count);
+            }
+            rng.seed(seeds[k]);
+            const Sampler& local = replicas.empty() ? sampler : *replicas[k % node_count];
+            sample_into(options, local, thread_first_index, count, thread_dags[k], thread_edge_counts[k]);
+        });
+        thread_first_index += count;
+    }
+    for(std::thread& thread : threads) {
+        thread.join();
+    }
+
+    for(int k = 0; k < thread_count; ++k) {
+        for(std::vector<int>& dag : thread_dags[k]) {
+            dags.push_back(std::move(dag));
+        }
+        edge_counts.add(thread_edge_counts[k]);
+    }
+}
+
+// Throws std::runtime_error if the constraints leave no DAG of positive
+// weight, as the samplers would then return arbitrary DAGs.
+template <class Sampler>
+void check_positive_weight(const Sampler& sampler) {
+    typedef decltype(sampler.total_weight()) Weight;
+    if(!(sampler.total_weight() > Weight::zero())) {
+        throw std::runtime_error("No DAG has positive weight");
+    }
+}
+
+// Writes the sampled DAGs (or edge counts) to out and other information to log.
+template <class Sampler>
+void run_sampler(const Options& options, int number_of_dags, typename Sampler::WeightT weights, const std::vector<int>& earlier,
+    std::ostream& out, std::ostream& log) {
+    uint64_t first_index = 0;
+    if(options.shard_count) {
+        first_index = part_begin(0, number_of_dags, options.shard_index, options.shard_count);
+        uint64_t end_index = part_begin(0, number_of_dags, options.shard_index + 1, options.shard_count);
+        log << "Shard " << options.shard_index << "/" << options.shard_count << ": DAGs " << first_index << " to " << end_index << " of " << number_of_dags << "\n";
+        number_of_dags = end_index - first_index;
+    }
+    log << "Sampling " << number_of_dags << " DAGs\n";
+
+    auto begin = std::chrono::steady_clock::now();
+
+    Sampler sampler = construct_sampler(options, std::move(weights), earlier, (Sampler*)nullptr);
+    check_positive_weight(sampler);
+
+    auto mid = std::chrono::steady_clock::now();
+
+    report_storage_error(log, sampler);
+    
+    std::vector<std::vector<int>> dags;
+    EdgeCounts edge_counts(sampler.size());
+    if(options.sampling_threads == 1 && options.numa == NUMA_NONE) {
+        sample_into(options, sampler, first_index, number_of_dags, dags, edge_counts);
+    } else {
+        sample_parallel(options, sampler, first_index, number_of_dags, dags, edge_counts);
+    }
+
+    auto end = std::chrono::steady_clock::now();
+
+    if(options.stats) {
+        write_edge_counts(out, edge_counts);
+    } else {
+        write_dags(out, dags);
+    }
+    double pre_elapsed_secs = std::chrono::duration<double>(mid - begin).count();
+    double samp_elapsed_secs = std::chrono::duration<double>(end - mid).count();
+    log << "Precomputation: " << pre_elapsed_secs << "s\n";
+    if(number_of_dags > 0) {
+        log << "Per DAG: " << samp_elapsed_secs / number_of_dags << "s\n";
+    }
+}
+
+// Runs the sampler specialized for the number of nodes, if there is one.
+template <int N>
+bool run_fixed_sampler(const Options& options, int number_of_dags, std::vector<std::vector<Lognum>>& weights, const std::vector<int>& earlier,
+    std::ostream& out, std::ostream& log) {
+    if((int)weights.size() == N) {
+        run_sampler<FixedNonSymmetricSampler<Lognum, N>>(options, number_of_dags, std::move(weights), earlier, out, log);
+        return true;
+    }
+    return run_fixed_sampler<N - 1>(options, number_of_dags, weights, earlier, out, log);
+}
+template <>
+bool run_fixed_sampler<0>(const Options&, int, std::vector<std::vector<Lognum>>&, const std::vector<int>&, std::ostream&, std::ostream&) {
+    return false;
+}
+
+void run_client(const Options& options, int number_of_dags, server_::ModelType model_type, int size, std::vector<char> payload,
+    std::ostream& out, std::ostream& log) {
+    using namespace server_;
+
+    log << "Requesting " << number_of_dags << " DAGs from " << options.socket_path << "\n";
+
+    Request request;
+    request.model_type = model_type;
+    request.operation = options.stats ? EDGE_STATISTICS : SAMPLE_DAGS;
+    request.size = size;
+    request.payload = std::move(payload);
+
+    // Large jobs are split into requests of at most the size accepted by the server
+    uint64_t max_count = options.stats ? MAX_STATISTICS_DAGS : MAX_SAMPLE_WORDS / size;
+
+    auto begin = std::chrono::steady_clock::now();
+    EdgeCounts edge_counts(size);
+    std::vector<std::vector<int>> dags;
+    uint64_t done = 0;
+    do {
+        request.count = std::min(max_count, (uint64_t)number_of_dags - done);
+        Response response = send_request(options.socket_path, request);
+        if(response.status != STATUS_OK) {
+            std::cerr << "Server error: " << std::string(response.payload.begin(), response.payload.end()) << "\n";
+            exit(1);
+        }
+        if(options.stats) {
+            edge_counts.add(decode_edge_counts(request, response));
+        } else {
+            for(std::vector<int>& dag : decode_dags(request, response)) {
+                dags.push_back(std::move(dag));
+            }
+        }
+        done += request.count;
+    } while(done < (uint64_t)number_of_dags);
+    auto end = std::chrono::steady_clock::now();
+
+    if(options.stats) {
+        write_edge_counts(out, edge_counts);
+    } else {
+        write_dags(out, dags);
+    }
+    log << "Request: " << std::chrono::duration<double>(end - begin).count() << "s\n";
+}
+
+// Finds a DAG of maximum weight with the same dynamic programming as the
+// sampler, run in the max-times semiring.
+void write_map_dag(const Options& options, const std::vector<std::vector<Lognum>>& weights, const std::vector<int>& earlier, std::ostream& log) {
+    std::vector<std::vector<MaxLognum>> max_weights(weights.size());
+    for(size_t i = 0; i < weights.size(); ++i) {
+        for(Lognum weight : weights[i]) {
+            max_weights[i].push_back(MaxLognum::from_log(weight.to_log()));
+        }
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+    NonSymmetricSampler<MaxLognum> map_finder(std::move(max_weights), "", false, earlier);
+    check_positive_weight(map_finder);
+    std::vector<std::vector<int>> dags = {map_finder.sample()};
+    auto end = std::chrono::steady_clock::now();
+
+    log << "Maximum weight DAG: " << std::chrono::duration<double>(end - begin).count() << "s, log weight " << map_finder.total_weight().to_log() << "\n";
+
+    std::ofstream out;
+    out.exceptions(out.failbit | out.badbit);
+    out.open(options.map_file);
+    write_dags(out, dags);
+}
+
+// Whether the nonsymmetric model is sampled here, so that an engine is chosen
+// by plan_engine, rather than sent to a server.
+bool needs_engine(const Options& options) {
+    return options.socket_path.empty();
+}
+
+// Estimates the resources needed by the nonsymmetric engines before the
+// weights are read, and returns the engine to use: the one given by the
+// options or, with --engine auto, the first engine that fits of the exact
+// engines in memory (or in files, with a table directory) in order of speed,
+// followed by their float versions. With --plan, exits after writing the
+// report to out. If the engine does not fit, the report is written to log
+// and std::runtime_error is thrown, as it is without a report if the engine
+// fixed is given for too many nodes.
+Engine plan_engine(const Options& options, int n_dags, const ModelSummary& model, int concurrent_models,
+    std::ostream& out, std::ostream& log) {
+
+    PlanSettings settings;
+    settings.table_dir = options.table_dir;
+    settings.resume = options.resume;
+    settings.map = !options.map_file.empty();
+    settings.replicate = options.numa == NUMA_REPLICATE;
+    if(!options.stats) {
+        // A shard has at most one seed block more than its even share
+        settings.stored_dags = options.shard_count ? std::min<uint64_t>(n_dags, n_dags / options.shard_count + SEED_BLOCK) : n_dags;
+    }
+    settings.concurrent_models = concurrent_models;
+    settings.memory_limit = options.max_memory;
+    ResourcePlan plan(model, settings);
+    if(options.plan) {
+        plan.estimate_times();
+    }
+
+    std::vector<Engine> candidates;
+    if(options.auto_engine && options.table_dir.empty()) {
+        candidates = {ENGINE_FIXED, ENGINE_DENSE, ENGINE_FLOAT};
+    } else if(options.auto_engine) {
+        candidates = {ENGINE_DISK, ENGINE_DISK_FLOAT};
+    } else if(options.engine_given) {
+        candidates = {options.engine};
+    } else if(!options.table_dir.empty()) {
+        candidates = {options.single_precision ? ENGINE_DISK_FLOAT : ENGINE_DISK};
+    } else if(options.single_precision) {
+        candidates = {ENGINE_FLOAT};
+    } else {
+        candidates = {model.size <= fixed_::MAX_SIZE ? ENGINE_FIXED : ENGINE_DENSE};
+    }
+    int chosen = plan.choose(candidates);
+
+    if(options.plan) {
+        plan.write_report(out, chosen);
+        exit(chosen >= 0 ? 0 : 1);
+    }
+    if(chosen < 0 && candidates.size() == 1 && candidates[0] == ENGINE_FIXED && model.size > fixed_::MAX_SIZE) {
+        // Not a matter of resources, so the report would not help
+        throw std::runtime_error("The engine fixed supports at most " + std::to_string(fixed_::MAX_SIZE) + " nodes");
+    }
+    if(chosen < 0) {
+        plan.write_report(log, chosen);
+        std::string message = std::string("Not enough resources for the ") + (candidates.size() == 1 ? "engine " : "engines ");
+        for(size_t idx = 0; idx < candidates.size(); ++idx) {
+            message += (idx ? ", " : "") + std::string(engine_name(candidates[idx]));
+        }
+        throw std::runtime_error(message + " (see --engine and --table-dir)");
+    }
 
-    clock_t end = clock();
+    const EngineEstimate& estimate = plan.estimate((Engine)chosen);
+    log << "Engine: " << engine_name((Engine)chosen) << ", estimated memory " << (estimate.memory >> 20) << " MiB of "
+        << (plan.machine().memory >> 20) << " MiB available\n";
+    return (Engine)chosen;
+}
+
+// Samples the model with the engine chosen by plan_engine, or sends it to the
+// server, which ignores the engine. earlier is the layer
+// ordering of the constraints, see Constraints::layer_order.
+void run_nonsymmetric(const Options& options, int n_dags, std::vector<std::vector<Lognum>> weights, const std::vector<int>& earlier,
+    Engine engine, std::ostream& out, std::ostream& log) {
+    if(!options.map_file.empty()) {
+        write_map_dag(options, weights, earlier, log);
+    }
+    if(options.socket_path.empty() && engine_uses_float(engine)) {
+        nonsymmetric_::normalize_weights(weights);
+        run_sampler<NonSymmetricSampler<Lognum, LogFloat>>(options, n_dags, std::move(weights), earlier, out, log);
+    } else if(options.socket_path.empty()) {
+        if(engine != ENGINE_FIXED || !run_fixed_sampler<fixed_::MAX_SIZE>(options, n_dags, weights, earlier, out, log)) {
+            run_sampler<NonSymmetricSampler<Lognum>>(options, n_dags, std::move(weights), earlier, out, log);
+        }
+    } else if(!earlier.empty()) {
+        // The server receives only the weights
+        throw std::runtime_error("Layer orderings are not supported by the server");
+    } else {
+        int size = weights.size();
+        run_client(options, n_dags, server_::NONSYMMETRIC_MODEL, size, server_::encode_nonsymmetric_weights(weights), out, log);
+    }
+}
 
-    write_dags(dags);
-    double pre_elapsed_secs = double(mid - begin) / CLOCKS_PER_SEC;
-    double samp_elapsed_secs = double(end - mid) / CLOCKS_PER_SEC;
-    std::cerr << "Precomputation: " << pre_elapsed_secs << "s\n";
-    std::cerr << "Per DAG: " << samp_elapsed_secs / number_of_dags << "s\n";
+// Symmetric weights with constraints or a maximum weight DAG are sampled using the nonsymmetric sampler.
+void run_symmetric(const Options& options, int n_dags, std::vector<Lognum> weights, std::ostream& out, std::ostream& log) {
+    if(!options.constraints_file.empty() || !options.map_file.empty()) {
+        if(weights.size() >= 31) {
+            std::cerr << "Too many nodes for constraints or maximum weight DAG\n";
+            exit(1);
+        }
+        Engine engine = ENGINE_DENSE;
+        if(needs_engine(options)) {
+            engine = plan_engine(options, n_dags, summarize_symmetric_weights(weights), 1, out, log);
+        }
+        std::vector<std::vector<Lognum>> expanded = expand_symmetric_weights(weights);
+        std::vector<int> earlier;
+        if(!options.constraints_file.empty()) {
+            Constraints constraints = read_constraints(options.constraints_file, weights.size());
+            apply_constraints_or_throw(expanded, constraints);
+            earlier = constraints.layer_order();
+        }
+        run_nonsymmetric(options, n_dags, std::move(expanded), earlier, engine, out, log);
+    } else if(options.engine_given || options.plan) {
+        std::cerr << "--engine and --plan are only supported by the nonsymmetric sampler\n";
+        exit(1);
+    } else if(options.socket_path.empty()) {
+        run_sampler<SymmetricSampler<Lognum>>(options, n_dags, std::move(weights), {}, out, log);
+    } else {
+        int size = weights.size();
+        run_client(options, n_dags, server_::SYMMETRIC_MODEL, size, server_::encode_symmetric_weights(weights), out, log);
+    }
+}
+
+// Runs the nonsymmetric models listed in the manifest file in parallel, each
+// model on a single worker thread, writing the output of each model to its own file.
+void run_batch(const Options& options, const std::string& manifest_file) {
+    std::vector<ManifestEntry> manifest = read_manifest(manifest_file);
+    std::cerr << "Running " << manifest.size() << " models with " << options.threads << " threads\n";
+    // Each model is planned with an even share of the memory
+    int concurrent_models = std::max(1, (int)std::min(manifest.size(), (size_t)options.threads));
+
+    std::mutex log_mutex;
+    std::atomic<int> failures(0);
+    {
+        ThreadPool pool(options.threads);
+        for(size_t idx = 0; idx < manifest.size(); ++idx) {
+            pool.submit([&, idx]() {
+                const ManifestEntry& entry = manifest[idx];
+                std::ostringstream log;
+                log << "Model " << idx << " (" << entry.weight_file << "):\n";
+                try {
+                    rng.seed(entry.seed);
+                    Engine engine = ENGINE_DENSE;
+                    if(needs_engine(options)) {
+                        ModelSummary summary = read_nonsymmetric_summary(entry.weight_file);
+                        engine = plan_engine(options, entry.number_of_dags, summary, concurrent_models, log, log);
+                    }
+                    std::vector<int> earlier;
+                    std::vector<std::vector<Lognum>> weights = read_nonsymmetric_weights<Lognum>(entry.weight_file, options.constraints_file, &earlier);
+                    std::ofstream out;
+                    out.exceptions(out.failbit | out.badbit);
+                    out.open(entry.output_file);
+                    run_nonsymmetric(options, entry.number_of_dags, std::move(weights), earlier, engine, out, log);
+                } catch(const std::exception& e) {
+                    log << "Failed: " << e.what() << "\n";
+                    ++failures;
+                }
+                std::unique_lock<std::mutex> lock(log_mutex);
+                std::cerr << log.str();
+            });
+        }
+    }
+
+    if(failures) {
+        std::cerr << failures << " models failed\n";
+        exit(1);
+    }
+}
+
+// Merges the outputs of the shards of a sampling job, given in the order of
+// the shards: the sampled DAGs are concatenated, and edge counts are added.
+void merge_outputs(const std::vector<std::string>& files, std::ostream& out) {
+    if(files.empty()) {
+        std::cerr << "No files to merge\n";
+        exit(1);
+    }
+
+    std::vector<std::string> dag_lines;
+    EdgeCounts edge_counts;
+    bool stats = false;
+    for(size_t idx = 0; idx < files.size(); ++idx) {
+        bool file_stats = read_sampler_output(files[idx], dag_lines, edge_counts, !stats);
+        if(idx && file_stats != stats) {
+            std::cerr << "Cannot merge sampled DAGs with edge counts\n";
+            exit(1);
+        }
+        stats = file_stats;
+    }
+
+    if(stats) {
+        write_edge_counts(out, edge_counts);
+    } else {
+        for(const std::string& line : dag_lines) {
+            out << line << "\n";
+        }
+    }
 }
 
 void usage() {
     std::cerr << "Usage:\n";
-    std::cerr << "    ./sampler symmetric uniform <number_of_nodes> <number_of_dags>\n";
-    std::cerr << "    ./sampler symmetric input <input_file> <number_of_dags>\n";
-    std::cerr << "    ./sampler nonsymmetric <input_file> <number_of_dags>\n";
+    std::cerr << "    ./sampler symmetric uniform <number_of_nodes> <number_of_dags> [options]\n";
+    std::cerr << "    ./sampler symmetric input <input_file> <number_of_dags> [options]\n";
+    std::cerr << "    ./sampler nonsymmetric <input_file> <number_of_dags> [options]\n";
+    std::cerr << "    ./sampler client <socket_path> <any of the above commands>\n";
+    std::cerr << "    ./sampler server <socket_path> [options]\n";
+    std::cerr << "    ./sampler batch <manifest_file> [options]\n";
+    std::cerr << "    ./sampler merge <output_file>...\n";
+    std::cerr << "Options:\n";
+    std::cerr << "    --constraints <constraint_file>    Sample only DAGs that satisfy the constraints\n";
+    std::cerr << "    --stats                            Output edge counts instead of the DAGs\n";
+    std::cerr << "    --threads <number_of_threads>      Number of server or batch worker threads (default: number of cores)\n";
+    std::cerr << "    --cache <number_of_models>         Number of models cached by the server (default: 16)\n";
+    std::cerr << "    --precision <double|float>         Precision of the nonsymmetric sampler tables (default: double)\n";
+    std::cerr << "    --table-dir <directory>            Store the nonsymmetric sampler tables in files in the directory\n";
+    std::cerr << "    --resume                           Continue an interrupted precomputation in the table directory\n";
+    std::cerr << "    --seed <seed>                      Seed of the random number generator\n";
+    std::cerr << "    --batch-size <number_of_dags>      Number of DAGs sampled together by the nonsymmetric sampler (default: 1)\n";
+    std::cerr << "    --sampling-threads <number>        Number of threads sampling DAGs from the same tables (default: 1)\n";
+    std::cerr << "    --numa <none|interleave|replicate> Spread the tables over the NUMA nodes or copy them to each node,\n";
+    std::cerr << "                                       and pin the sampling threads to the nodes (default: none)\n";
+    std::cerr << "    --shard <i>/<N>                    Sample only the ith of N equal parts of the DAGs, seeding each block\n";
+    std::cerr << "                                       of 1024 DAGs by its index (requires --seed; see merge)\n";
+    std::cerr << "    --map <output_file>                Also write a DAG of maximum weight to the file\n";
+    std::cerr << "    --engine <engine>                  Nonsymmetric engine: auto, fixed, dense, float, disk or disk-float\n";
+    std::cerr << "                                       (default: from --precision and --table-dir)\n";
+    std::cerr << "    --plan                             Print the memory, disk and time estimates of the engines and exit\n";
+    std::cerr << "    --max-memory <MiB>                 Memory limit of a model for the engines and the server\n";
+    std::cerr << "                                       (default: the available memory)\n";
 }
 
-int main(int argc, char* argv[]) {
+int run(int argc, char* argv[]) {
     int argi = 1;
     auto getArg = [&]() {
         if(argi >= argc) {
@@ -71,33 +664,183 @@ int main(int argc, char* argv[]) {
         }
         return argv[argi++];
     };
-    auto argsDone = [&]() {
-        if(argi != argc) {
-            std::cerr << "Extra command line arguments\n";
-            usage();
+
+    Options options;
+    bool precision_given = false;
+    auto parseOptions = [&]() {
+        while(argi < argc) {
+            std::string option = getArg();
+            if(option == "--constraints") {
+                options.constraints_file = getArg();
+            } else if(option == "--stats") {
+                options.stats = true;
+            } else if(option == "--threads") {
+                options.threads = std::stoi(getArg());
+                if(options.threads <= 0) {
+                    std::cerr << "Invalid number of threads\n";
+                    exit(1);
+                }
+            } else if(option == "--precision") {
+                std::string precision = getArg();
+                if(precision != "double" && precision != "float") {
+                    std::cerr << "Unknown precision " << precision << "\n";
+                    exit(1);
+                }
+                options.single_precision = precision == "float";
+                precision_given = true;
+            } else if(option == "--table-dir") {
+                options.table_dir = getArg();
+            } else if(option == "--resume") {
+                options.resume = true;
+            } else if(option == "--seed") {
+                options.seeded = true;
+                options.seed = std::stoul(getArg());
+            } else if(option == "--batch-size") {
+                options.batch_size = std::stoi(getArg());
+                if(options.batch_size < 1) {
+                    std::cerr << "Invalid batch size\n";
+                    exit(1);
+                }
+            } else if(option == "--sampling-threads") {
+                options.sampling_threads = std::stoi(getArg());
+                if(options.sampling_threads <= 0) {
+                    std::cerr << "Invalid number of threads\n";
+                    exit(1);
+                }
+            } else if(option == "--numa") {
+                std::string placement = getArg();
+                if(placement == "none") {
+                    options.numa = NUMA_NONE;
+                } else if(placement == "interleave") {
+                    options.numa = NUMA_INTERLEAVE;
+                } else if(placement == "replicate") {
+                    options.numa = NUMA_REPLICATE;
+                } else {
+                    std::cerr << "Unknown NUMA placement " << placement << "\n";
+                    exit(1);
+                }
+            } else if(option == "--shard") {
+                std::string shard = getArg();
+                size_t slash = shard.find('/');
+                if(slash != std::string::npos) {
+                    options.shard_index = std::stoi(shard.substr(0, slash));
+                    options.shard_count = std::stoi(shard.substr(slash + 1));
+                }
+                if(options.shard_count <= 0 || options.shard_index < 0 || options.shard_index >= options.shard_count) {
+                    std::cerr << "Invalid shard " << shard << "\n";
+                    exit(1);
+                }
+            } else if(option == "--engine") {
+                std::string engine = getArg();
+                options.engine_given = true;
+                options.auto_engine = engine == "auto";
+                if(!options.auto_engine && !parse_engine(engine, options.engine)) {
+                    std::cerr << "Unknown engine " << engine << "\n";
+                    exit(1);
+                }
+            } else if(option == "--plan") {
+                options.plan = true;
+            } else if(option == "--max-memory") {
+                options.max_memory = (uint64_t)std::stoull(getArg()) << 20;
+                if(!options.max_memory) {
+                    std::cerr << "Invalid memory limit\n";
+                    exit(1);
+                }
+            } else if(option == "--map") {
+                options.map_file = getArg();
+            } else if(option == "--cache") {
+                options.cache_capacity = std::stoul(getArg());
+            } else {
+                std::cerr << "Unknown option " << option << "\n";
+                usage();
+                exit(1);
+            }
+        }
+        if(options.resume && options.table_dir.empty()) {
+            std::cerr << "--resume requires --table-dir\n";
             exit(1);
         }
+        if(options.numa == NUMA_REPLICATE && !options.table_dir.empty()) {
+            // The copies would be made in anonymous memory on each node
+            std::cerr << "--numa replicate cannot be used with --table-dir\n";
+            exit(1);
+        }
+        if(options.shard_count && (!options.seeded || options.batch_size != 1 || !options.socket_path.empty())) {
+            std::cerr << "--shard requires --seed and cannot be used with --batch-size or a server\n";
+            exit(1);
+        }
+        if(options.engine_given && precision_given) {
+            std::cerr << "--engine and --precision cannot be used together\n";
+            exit(1);
+        }
+        if(options.engine_given && !options.auto_engine) {
+            if(engine_uses_disk(options.engine) == options.table_dir.empty()) {
+                std::cerr << "The engines disk and disk-float, and only they, require --table-dir\n";
+                exit(1);
+            }
+            options.single_precision = engine_uses_float(options.engine);
+        }
+        if((options.engine_given || options.plan) && !options.socket_path.empty()) {
+            std::cerr << "--engine and --plan cannot be used with a server\n";
+            exit(1);
+        }
+        if(options.seeded) {
+            rng.seed(options.seed);
+        }
     };
 
     std::string symmetry_type = getArg();
 
+    if(symmetry_type == "server") {
+        std::string socket_path = getArg();
+        parseOptions();
+        run_server(socket_path, options.threads, options.cache_capacity, options.max_memory);
+        return 0;
+    }
+    if(symmetry_type == "batch") {
+        std::string manifest_file = getArg();
+        parseOptions();
+        if(options.seeded) {
+            std::cerr << "Seeds of batch models are given in the manifest\n";
+            exit(1);
+        }
+        if(!options.map_file.empty() || options.shard_count || options.plan || !options.table_dir.empty()) {
+            std::cerr << "Maximum weight DAGs, shards, plans and table directories are not supported in batch mode\n";
+            exit(1);
+        }
+        run_batch(options, manifest_file);
+        return 0;
+    }
+    if(symmetry_type == "merge") {
+        std::vector<std::string> files;
+        while(argi < argc) {
+            files.push_back(argv[argi++]);
+        }
+        merge_outputs(files, std::cout);
+        return 0;
+    }
+    if(symmetry_type == "client") {
+        options.socket_path = getArg();
+        symmetry_type = getArg();
+    }
+
     if(symmetry_type == "symmetric") {
         std::string weight_arg = getArg();
 
         if(weight_arg == "uniform") {
             int size = std::stoi(getArg());
             int n_dags = std::stoi(getArg());
-            argsDone();
+            parseOptions();
 
             std::vector<Lognum> weights(size, Lognum::one());
-            run_sampler<SymmetricSampler<Lognum>>(n_dags, std::move(weights));
+            run_symmetric(options, n_dags, std::move(weights), std::cout, std::cerr);
         } else if (weight_arg == "input") {
             std::string input = getArg();
             int n_dags = std::stoi(getArg());
-            argsDone();
+            parseOptions();
 
             std::vector<Lognum> weights = read_symmetric_weights<Lognum>(input);
-            run_sampler<SymmetricSampler<Lognum>>(n_dags, std::move(weights));
+            run_symmetric(options, n_dags, std::move(weights), std::cout, std::cerr);
         } else {
             std::cerr << "Unknown weight type " << weight_arg << "\n";
             usage();
@@ -106,10 +849,15 @@ int main(int argc, char* argv[]) {
     } else if (symmetry_type == "nonsymmetric") {
         std::string input = getArg();
         int n_dags = std::stoi(getArg());
-        argsDone();
+        parseOptions();
         
-        std::vector<std::vector<Lognum>> weights = read_nonsymmetric_weights<Lognum>(input);
-        run_sampler<NonSymmetricSampler<Lognum>>(n_dags, std::move(weights));
+        Engine engine = ENGINE_DENSE;
+        if(needs_engine(options)) {
+            engine = plan_engine(options, n_dags, read_nonsymmetric_summary(input), 1, std::cout, std::cerr);
+        }
+        std::vector<int> earlier;
+        std::vector<std::vector<Lognum>> weights = read_nonsymmetric_weights<Lognum>(input, options.constraints_file, &earlier);
+        run_nonsymmetric(options, n_dags, std::move(weights), earlier, engine, std::cout, std::cerr);
     } else {
         std::cerr << "Unknown symmetry type " << symmetry_type << "\n";
         usage();
@@ -118,3 +866,12 @@ int main(int argc, char* argv[]) {
 
     return 0;
 }
+
+int main(int argc, char* argv[]) {
+    try {
+        return run(argc, argv);
+    } catch(const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+}
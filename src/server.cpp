@@ -0,0 +1,616 @@
+#include "server.h"
+#include "fixed.h"
+#include "nonsymmetric.h"
+#include "planner.h"
+#include "symmetric.h"
+#include "threadpool.h"
+
+#include <cerrno>
+#include <cstring>
+#include <future>
+#include <list>
+#include <thread>
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace server_ {
+
+const size_t HEADER_SIZE = 28;
+
+template <typename V>
+void append(std::vector<char>& buf, V value) {
+    const char* bytes = (const char*)&value;
+    buf.insert(buf.end(), bytes, bytes + sizeof(V));
+}
+
+// Reads values from a byte buffer, keeping track of whether the buffer was long enough.
+class Reader {
+public:
+    Reader(const std::vector<char>& buf, size_t pos = 0) : buf(buf), pos(pos), ok(true) {}
+
+    template <typename V>
+    V read() {
+        V value = V();
+        if(pos + sizeof(V) > buf.size()) {
+            ok = false;
+            return value;
+        }
+        memcpy(&value, buf.data() + pos, sizeof(V));
+        pos += sizeof(V);
+        return value;
+    }
+
+    bool good() const {
+        return ok;
+    }
+
+    bool done() const {
+        return ok && pos == buf.size();
+    }
+
+private:
+    const std::vector<char>& buf;
+    size_t pos;
+    bool ok;
+};
+
+bool read_all(int fd, char* data, size_t size) {
+    while(size) {
+        ssize_t got = read(fd, data, size);
+        if(got < 0 && errno == EINTR) {
+            continue;
+        }
+        if(got <= 0) {
+            return false;
+        }
+        data += got;
+        size -= got;
+    }
+    return true;
+}
+
+bool write_all(int fd, const char* data, size_t size) {
+    while(size) {
+        ssize_t written = write(fd, data, size);
+        if(written < 0 && errno == EINTR) {
+            continue;
+        }
+        if(written <= 0) {
+            return false;
+        }
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+std::vector<char> encode_symmetric_weights(const std::vector<Lognum>& weights) {
+    std::vector<char> payload;
+    for(Lognum weight : weights) {
+        append<double>(payload, weight.to_log());
+    }
+    return payload;
+}
+
+std::vector<char> encode_nonsymmetric_weights(const std::vector<std::vector<Lognum>>& weights) {
+    std::vector<char> payload;
+    for(const std::vector<Lognum>& node_weights : weights) {
+        uint32_t count = 0;
+        for(Lognum weight : node_weights) {
+            count += weight > Lognum::zero();
+        }
+        append<uint32_t>(payload, count);
+        for(uint32_t S = 0; S < node_weights.size(); ++S) {
+            if(node_weights[S] > Lognum::zero()) {
+                append<uint32_t>(payload, S);
+                append<double>(payload, node_weights[S].to_log());
+            }
+        }
+    }
+    return payload;
+}
+
+std::vector<std::vector<int>> decode_dags(const Request& request, const Response& response) {
+    std::vector<std::vector<int>> dags(request.count, std::vector<int>(request.size));
+    Reader reader(response.payload);
+    for(std::vector<int>& dag : dags) {
+        for(int& parents : dag) {
+            parents = reader.read<uint32_t>();
+        }
+    }
+    if(!reader.done()) {
+        std::cerr << "Invalid response from server\n";
+        exit(1);
+    }
+    return dags;
+}
+
+EdgeCounts decode_edge_counts(const Request& request, const Response& response) {
+    EdgeCounts edge_counts(request.size);
+    Reader reader(response.payload);
+    edge_counts.samples = reader.read<uint64_t>();
+    for(uint64_t& count : edge_counts.counts) {
+        count = reader.read<uint64_t>();
+    }
+    if(!reader.done()) {
+        std::cerr << "Invalid response from server\n";
+        exit(1);
+    }
+    return edge_counts;
+}
+
+class CachedModel {
+public:
+    virtual ~CachedModel() {}
+    virtual std::vector<int> sample() const = 0;
+};
+
+template <class Sampler>
+class CachedSampler : public CachedModel {
+public:
+    CachedSampler(Sampler sampler) : sampler(std::move(sampler)) {}
+
+    std::vector<int> sample() const override {
+        return sampler.sample();
+    }
+
+private:
+    Sampler sampler;
+};
+
+typedef std::shared_ptr<const CachedModel> ModelPtr;
+
+// Builds the fixed sampler for the number of nodes, which is at most N.
+template <int N>
+ModelPtr build_fixed_model(std::vector<std::vector<Lognum>>& weights) {
+    if((int)weights.size() != N) {
+        return build_fixed_model<N - 1>(weights);
+    }
+    FixedNonSymmetricSampler<Lognum, N> sampler(std::move(weights));
+    if(!(sampler.total_weight() > Lognum::zero())) {
+        return nullptr;
+    }
+    return std::make_shared<CachedSampler<FixedNonSymmetricSampler<Lognum, N>>>(std::move(sampler));
+}
+template <>
+ModelPtr build_fixed_model<0>(std::vector<std::vector<Lognum>>&) {
+    return nullptr;
+}
+
+// Parses the weights in the request payload and builds the sampler. Returns
+// nullptr and sets error if the model is invalid or does not fit in memory.
+// Nonsymmetric models are planned as in the command line interface (see
+// planner.h) before their weights are stored, and sampled with the fixed
+// engine if they have at most fixed_::MAX_SIZE nodes and the dense one
+// otherwise.
+ModelPtr build_model(const Request& request, const PlanSettings& settings, std::string& error) {
+    uint32_t size = request.size;
+    if(size == 0 || size > MAX_SIZE) {
+        error = "Invalid number of nodes";
+        return nullptr;
+    }
+
+    Reader reader(request.payload);
+    if(request.model_type == SYMMETRIC_MODEL) {
+        std::vector<Lognum> weights(size);
+        for(Lognum& weight : weights) {
+            weight = Lognum::from_log(reader.read<double>());
+        }
+        if(!reader.done()) {
+            error = "Invalid symmetric weights";
+            return nullptr;
+        }
+        if(!(weights[0] > Lognum::zero())) {
+            error = "No DAG has positive weight";
+            return nullptr;
+        }
+        SymmetricSampler<Lognum> sampler(std::move(weights));
+        return std::make_shared<CachedSampler<SymmetricSampler<Lognum>>>(std::move(sampler));
+    }
+
+    if(request.model_type == NONSYMMETRIC_MODEL) {
+        // The payload is validated and summarized first, as the weights take n 2^n entries
+        ModelSummary summary = {(int)size, 0, 0};
+        for(uint32_t i = 0; i < size; ++i) {
+            uint32_t count = reader.read<uint32_t>();
+            for(uint32_t j = 0; j < count && reader.good(); ++j) {
+                uint32_t parents = reader.read<uint32_t>();
+                reader.read<double>();
+                if(parents >= ((uint32_t)1 << size) || (parents & ((uint32_t)1 << i))) {
+                    error = "Invalid parent set";
+                    return nullptr;
+                }
+                ++summary.parent_sets;
+                summary.max_in_degree = std::max(summary.max_in_degree, __builtin_popcount(parents));
+            }
+        }
+        if(!reader.done()) {
+            error = "Invalid nonsymmetric weights";
+            return nullptr;
+        }
+
+        Engine engine = size <= (uint32_t)fixed_::MAX_SIZE ? ENGINE_FIXED : ENGINE_DENSE;
+        ResourcePlan plan(summary, settings);
+        if(plan.choose({engine}) < 0) {
+            const EngineEstimate& estimate = plan.estimate(engine);
+            error = std::string("Not enough memory for the engine ") + engine_name(engine) + ": estimated "
+                + std::to_string(estimate.memory >> 20) + " MiB of " + std::to_string(plan.machine().memory >> 20) + " MiB available";
+            return nullptr;
+        }
+
+        std::vector<std::vector<Lognum>> weights(size, std::vector<Lognum>((size_t)1 << size, Lognum::zero()));
+        Reader weight_reader(request.payload);
+        for(uint32_t i = 0; i < size; ++i) {
+            uint32_t count = weight_reader.read<uint32_t>();
+            for(uint32_t j = 0; j < count; ++j) {
+                uint32_t parents = weight_reader.read<uint32_t>();
+                weights[i][parents] = Lognum::from_log(weight_reader.read<double>());
+            }
+        }
+
+        ModelPtr model;
+        if(engine == ENGINE_FIXED) {
+            model = build_fixed_model<fixed_::MAX_SIZE>(weights);
+        } else {
+            NonSymmetricSampler<Lognum> sampler(std::move(weights));
+            if(sampler.total_weight() > Lognum::zero()) {
+                model = std::make_shared<CachedSampler<NonSymmetricSampler<Lognum>>>(std::move(sampler));
+            }
+        }
+        if(!model) {
+            error = "No DAG has positive weight";
+        }
+        return model;
+    }
+
+    error = "Invalid model type";
+    return nullptr;
+}
+
+uint64_t fnv1a(const std::vector<char>& data) {
+    uint64_t hash = 14695981039346656037ull;
+    for(char c : data) {
+        hash ^= (unsigned char)c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// LRU cache of built samplers keyed by the hash of the model. A model is
+// built only once even if it is requested concurrently: the later requests
+// wait for the first one to finish building it.
+class ModelCache {
+public:
+    ModelCache(size_t capacity, PlanSettings settings) : capacity(capacity), settings(std::move(settings)) {}
+
+    ModelPtr get(const Request& request, std::string& error) {
+        std::vector<char> key;
+        append<uint8_t>(key, request.model_type);
+        append<uint32_t>(key, request.size);
+        key.insert(key.end(), request.payload.begin(), request.payload.end());
+        uint64_t hash = fnv1a(key);
+
+        std::promise<ModelPtr> promise;
+        std::shared_future<ModelPtr> future;
+        bool build = false;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            auto it = find(hash, key);
+            if(it != entries.end()) {
+                entries.splice(entries.begin(), entries, it);
+                future = it->model;
+            } else {
+                future = promise.get_future().share();
+                entries.push_front(Entry{hash, key, future});
+                index.emplace(hash, entries.begin());
+                evict();
+                build = true;
+            }
+        }
+
+        if(build) {
+            ModelPtr model;
+            try {
+                model = build_model(request, settings, error);
+            } catch(const std::exception& e) {
+                error = e.what();
+            }
+            if(!model) {
+                std::unique_lock<std::mutex> lock(mutex);
+                auto it = find(hash, key);
+                if(it != entries.end()) {
+                    erase(it);
+                }
+            }
+            promise.set_value(model);
+            return model;
+        }
+
+        ModelPtr model = future.get();
+        if(!model) {
+            error = "Building the model failed";
+        }
+        return model;
+    }
+
+private:
+    struct Entry {
+        uint64_t hash;
+        std::vector<char> key;
+        std::shared_future<ModelPtr> model;
+    };
+
+    size_t capacity;
+    // Resources of the models, see build_model
+    PlanSettings settings;
+    std::mutex mutex;
+    // Most recently used first
+    std::list<Entry> entries;
+    std::unordered_multimap<uint64_t, std::list<Entry>::iterator> index;
+
+    std::list<Entry>::iterator find(uint64_t hash, const std::vector<char>& key) {
+        auto range = index.equal_range(hash);
+        for(auto it = range.first; it != range.second; ++it) {
+            if(it->second->key == key) {
+                return it->second;
+            }
+        }
+        return entries.end();
+    }
+
+    void erase(std::list<Entry>::iterator entry) {
+        auto range = index.equal_range(entry->hash);
+        for(auto it = range.first; it != range.second; ++it) {
+            if(it->second == entry) {
+                index.erase(it);
+                break;
+            }
+        }
+        entries.erase(entry);
+    }
+
+    void evict() {
+        while(entries.size() > capacity) {
+            erase(std::prev(entries.end()));
+        }
+    }
+};
+
+Response handle_request(const Request& request, ModelCache& cache) {
+    Response response;
+    response.status = STATUS_INVALID_REQUEST;
+
+    auto fail = [&](const std::string& message) {
+        response.payload.assign(message.begin(), message.end());
+        return response;
+    };
+
+    if(request.operation != SAMPLE_DAGS && request.operation != EDGE_STATISTICS) {
+        return fail("Invalid operation");
+    }
+    if(request.size == 0 || request.size > MAX_SIZE) {
+        return fail("Invalid number of nodes");
+    }
+    if(request.operation == SAMPLE_DAGS && request.count > MAX_SAMPLE_WORDS / request.size) {
+        return fail("Too many DAGs requested");
+    }
+    if(request.operation == EDGE_STATISTICS && request.count > MAX_STATISTICS_DAGS) {
+        return fail("Too many DAGs requested");
+    }
+
+    std::string error;
+    ModelPtr model = cache.get(request, error);
+    if(!model) {
+        return fail(error);
+    }
+
+    response.status = STATUS_OK;
+    if(request.operation == SAMPLE_DAGS) {
+        response.payload.reserve(request.count * request.size * sizeof(uint32_t));
+        for(uint64_t k = 0; k < request.count; ++k) {
+            for(int parents : model->sample()) {
+                append<uint32_t>(response.payload, parents);
+            }
+        }
+    } else {
+        EdgeCounts edge_counts(request.size);
+        for(uint64_t k = 0; k < request.count; ++k) {
+            edge_counts.add(model->sample());
+        }
+        append<uint64_t>(response.payload, edge_counts.samples);
+        for(uint64_t count : edge_counts.counts) {
+            append<uint64_t>(response.payload, count);
+        }
+    }
+    return response;
+}
+
+// Largest payload of a valid request for a model of the given type with size nodes
+uint64_t max_payload_size(uint8_t model_type, uint32_t size) {
+    if(size == 0 || size > MAX_SIZE) {
+        return 0;
+    }
+    if(model_type == SYMMETRIC_MODEL) {
+        return (uint64_t)size * sizeof(double);
+    }
+    if(model_type == NONSYMMETRIC_MODEL) {
+        // All parent sets of each node
+        return (uint64_t)size * (sizeof(uint32_t) + (sizeof(uint32_t) + sizeof(double)) * ((uint64_t)1 << (size - 1)));
+    }
+    return 0;
+}
+
+// Handles the request on a worker of the pool and waits for the response.
+// Errors while handling the request, such as running out of memory, are
+// sent to the client as STATUS_ERROR.
+Response handle_in_pool(const Request& request, ModelCache& cache, ThreadPool& pool) {
+    std::shared_ptr<std::promise<Response>> promise = std::make_shared<std::promise<Response>>();
+    std::future<Response> future = promise->get_future();
+    pool.submit([&request, &cache, promise]() {
+        Response response;
+        try {
+            response = handle_request(request, cache);
+        } catch(const std::exception& e) {
+            std::string message = std::string("Handling the request failed: ") + e.what();
+            response.status = STATUS_ERROR;
+            response.payload.assign(message.begin(), message.end());
+        }
+        promise->set_value(std::move(response));
+    });
+    return future.get();
+}
+
+void serve_connection(int fd, ModelCache& cache, ThreadPool& pool) {
+    while(true) {
+        std::vector<char> header(HEADER_SIZE);
+        if(!read_all(fd, header.data(), header.size())) {
+            return;
+        }
+
+        Reader reader(header);
+        uint32_t magic = reader.read<uint32_t>();
+        Request request;
+        request.model_type = reader.read<uint8_t>();
+        request.operation = reader.read<uint8_t>();
+        reader.read<uint16_t>();
+        request.size = reader.read<uint32_t>();
+        request.count = reader.read<uint64_t>();
+        uint64_t payload_size = reader.read<uint64_t>();
+
+        if(magic != REQUEST_MAGIC) {
+            return;
+        }
+
+        bool valid = payload_size <= std::min(max_payload_size(request.model_type, request.size), MAX_PAYLOAD_SIZE);
+
+        Response response;
+        if(valid) {
+            try {
+                request.payload.resize(payload_size);
+            } catch(const std::bad_alloc&) {
+                valid = false;
+            }
+        }
+        if(valid) {
+            if(!read_all(fd, request.payload.data(), payload_size)) {
+                return;
+            }
+            response = handle_in_pool(request, cache, pool);
+        } else {
+            // The payload is not read, so the connection is closed after the response
+            std::string message = "Invalid model size";
+            response.status = STATUS_INVALID_REQUEST;
+            response.payload.assign(message.begin(), message.end());
+        }
+
+        std::vector<char> out;
+        append<uint32_t>(out, RESPONSE_MAGIC);
+        append<uint32_t>(out, response.status);
+        append<uint64_t>(out, response.payload.size());
+        if(
+            !write_all(fd, out.data(), out.size()) ||
+            !write_all(fd, response.payload.data(), response.payload.size()) ||
+            !valid
+        ) {
+            return;
+        }
+    }
+}
+
+sockaddr_un socket_address(const std::string& socket_path) {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if(socket_path.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Too long socket path\n";
+        exit(1);
+    }
+    strcpy(address.sun_path, socket_path.c_str());
+    return address;
+}
+
+}
+
+server_::Response send_request(const std::string& socket_path, const server_::Request& request) {
+    using namespace server_;
+
+    sockaddr_un address = socket_address(socket_path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0 || connect(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+        std::cerr << "Could not connect to " << socket_path << ": " << strerror(errno) << "\n";
+        exit(1);
+    }
+
+    std::vector<char> out;
+    append<uint32_t>(out, REQUEST_MAGIC);
+    append<uint8_t>(out, request.model_type);
+    append<uint8_t>(out, request.operation);
+    append<uint16_t>(out, 0);
+    append<uint32_t>(out, request.size);
+    append<uint64_t>(out, request.count);
+    append<uint64_t>(out, request.payload.size());
+    out.insert(out.end(), request.payload.begin(), request.payload.end());
+
+    std::vector<char> header(16);
+    if(!write_all(fd, out.data(), out.size()) || !read_all(fd, header.data(), header.size())) {
+        std::cerr << "Communication with the server failed\n";
+        exit(1);
+    }
+
+    Reader reader(header);
+    uint32_t magic = reader.read<uint32_t>();
+    Response response;
+    response.status = reader.read<uint32_t>();
+    response.payload.resize(reader.read<uint64_t>());
+    if(magic != RESPONSE_MAGIC || !read_all(fd, response.payload.data(), response.payload.size())) {
+        std::cerr << "Invalid response from server\n";
+        exit(1);
+    }
+    close(fd);
+
+    return response;
+}
+
+void run_server(const std::string& socket_path, int thread_count, size_t cache_capacity, uint64_t max_memory) {
+    using namespace server_;
+
+    // Clients closing their connections early must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    sockaddr_un address = socket_address(socket_path);
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socket_path.c_str());
+    if(
+        listen_fd < 0 ||
+        bind(listen_fd, (sockaddr*)&address, sizeof(address)) != 0 ||
+        listen(listen_fd, 128) != 0
+    ) {
+        std::cerr << "Could not listen on " << socket_path << ": " << strerror(errno) << "\n";
+        exit(1);
+    }
+
+    std::cerr << "Listening on " << socket_path << " with " << thread_count << " threads\n";
+
+    // Each worker may be building a model
+    PlanSettings settings;
+    settings.concurrent_models = thread_count;
+    settings.memory_limit = max_memory;
+    ModelCache cache(cache_capacity, settings);
+    ThreadPool pool(thread_count);
+    while(true) {
+        int fd = accept(listen_fd, nullptr, nullptr);
+        if(fd < 0) {
+            if(errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            std::cerr << "Accepting connection failed: " << strerror(errno) << "\n";
+            exit(1);
+        }
+        std::thread([fd, &cache, &pool]() {
+            serve_connection(fd, cache, pool);
+            close(fd);
+        }).detach();
+    }
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "common.h"
+#include "lognum.h"
+#include "statistics.h"
+
+/*
+    Binary protocol of the sampling server. The server only listens on a local
+    Unix domain socket, so all integers and doubles are sent in host byte order.
+    A connection may carry any number of requests, each followed by a response.
+
+    Request:
+        u32 magic (REQUEST_MAGIC)
+        u8  model type (ModelType)
+        u8  operation (Operation)
+        u16 reserved, zero
+        u32 number of nodes n
+        u64 number of DAGs to sample
+        u64 payload size in bytes
+        payload, symmetric model: n x f64, logarithms of the weights of parent set sizes 0, ..., n - 1
+        payload, nonsymmetric model: for each node:
+            u32 number of parent sets
+            for each parent set: u32 parent set bitmask, f64 logarithm of the weight
+
+    Response:
+        u32 magic (RESPONSE_MAGIC)
+        u32 status (Status)
+        u64 payload size in bytes
+        payload, SAMPLE_DAGS: for each DAG, n x u32 parent set bitmasks
+        payload, EDGE_STATISTICS: u64 number of DAGs, n x n x u64 edge counts (as in EdgeCounts)
+        payload, error statuses: error message
+
+    The server rejects requests with more than MAX_SIZE nodes, payloads larger
+    than any valid encoding of a model with n nodes or than MAX_PAYLOAD_SIZE,
+    SAMPLE_DAGS requests with more than MAX_SAMPLE_WORDS parent sets in total,
+    and EDGE_STATISTICS requests for more than MAX_STATISTICS_DAGS DAGs.
+*/
+namespace server_ {
+
+const uint32_t REQUEST_MAGIC = 0x4d445351;
+const uint32_t RESPONSE_MAGIC = 0x4d445352;
+
+const uint32_t MAX_SIZE = 30;
+const uint64_t MAX_PAYLOAD_SIZE = (uint64_t)1 << 30;
+const uint64_t MAX_SAMPLE_WORDS = (uint64_t)1 << 28;
+const uint64_t MAX_STATISTICS_DAGS = (uint64_t)1 << 24;
+
+enum ModelType : uint8_t {
+    SYMMETRIC_MODEL = 0,
+    NONSYMMETRIC_MODEL = 1
+};
+
+enum Operation : uint8_t {
+    SAMPLE_DAGS = 0,
+    EDGE_STATISTICS = 1
+};
+
+enum Status : uint32_t {
+    STATUS_OK = 0,
+    STATUS_INVALID_REQUEST = 1,
+    STATUS_ERROR = 2
+};
+
+struct Request {
+    uint8_t model_type;
+    uint8_t operation;
+    uint32_t size;
+    uint64_t count;
+    std::vector<char> payload;
+};
+
+struct Response {
+    uint32_t status;
+    std::vector<char> payload;
+};
+
+std::vector<char> encode_symmetric_weights(const std::vector<Lognum>& weights);
+std::vector<char> encode_nonsymmetric_weights(const std::vector<std::vector<Lognum>>& weights);
+
+std::vector<std::vector<int>> decode_dags(const Request& request, const Response& response);
+EdgeCounts decode_edge_counts(const Request& request, const Response& response);
+
+}
+
+// Sends a request to the server listening on socket_path and waits for the response.
+server_::Response send_request(const std::string& socket_path, const server_::Request& request);
+
+// Serves requests on socket_path until the process is killed. Built samplers
+// are kept in a cache of at most cache_capacity models, from which the least
+// recently used model is evicted first. Each connection has its own thread
+// that reads the requests and writes the responses, and the requests are
+// handled by a pool of thread_count worker threads, so idle connections do
+// not hold workers. A model is only built if its estimated memory fits in
+// the memory available when the request arrives, shared evenly by the
+// workers, and in max_memory bytes if max_memory is nonzero; otherwise the
+// request fails with an error.
+void run_server(const std::string& socket_path, int thread_count, size_t cache_capacity, uint64_t max_memory);
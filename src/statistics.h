@@ -0,0 +1,32 @@
+#pragma once
+
+#include "common.h"
+
+// Number of sampled DAGs that contain each edge. Edge counts from separate
+// runs can be added together.
+struct EdgeCounts {
+    uint64_t samples;
+    int size;
+    // counts[i * size + j]: number of samples where j is a parent of i
+    std::vector<uint64_t> counts;
+
+    EdgeCounts(int size = 0) : samples(0), size(size), counts((size_t)size * size, 0) {}
+
+    void add(const std::vector<int>& dag) {
+        assert((int)dag.size() == size);
+        ++samples;
+        for(int i = 0; i < size; ++i) {
+            for(int parents = dag[i]; parents; parents &= parents - 1) {
+                ++counts[(size_t)i * size + __builtin_ctz(parents)];
+            }
+        }
+    }
+
+    void add(const EdgeCounts& other) {
+        assert(other.size == size);
+        samples += other.samples;
+        for(size_t k = 0; k < counts.size(); ++k) {
+            counts[k] += other.counts[k];
+        }
+    }
+};
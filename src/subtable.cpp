@@ -0,0 +1,118 @@
+#include "subtable.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+std::shared_ptr<const SubTableLayout> SubTableLayout::get(uint32_t n) {
+    static std::mutex mutex;
+    static std::map<uint32_t, std::weak_ptr<const SubTableLayout>> cache;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    std::shared_ptr<const SubTableLayout> ret = cache[n].lock();
+    if(ret) {
+        return ret;
+    }
+
+    std::shared_ptr<SubTableLayout> layout = std::make_shared<SubTableLayout>();
+    layout->offset.resize((size_t)1 << n);
+    layout->layer_begin.resize(n + 2);
+
+    uint64_t pos = 0;
+    for(uint32_t k = 0; k <= n; ++k) {
+        layout->layer_begin[k] = pos;
+        for(uint32_t U = ((uint32_t)1 << k) - 1; U < ((uint64_t)1 << n); U = next_same_popcount(U)) {
+            layout->offset[U] = pos;
+            pos += (uint64_t)1 << k;
+            if(U == 0) {
+                break;
+            }
+        }
+    }
+    layout->layer_begin[n + 1] = pos;
+
+    cache[n] = layout;
+    return layout;
+}
+
+TableMemory::TableMemory(size_t bytes) : bytes(bytes), file_backed(false) {
+    void* addr = mmap(nullptr, std::max(bytes, (size_t)1), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(addr == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+    ptr = (char*)addr;
+}
+
+TableMemory::TableMemory(size_t bytes, const std::string& path, bool reuse) : bytes(bytes), file_backed(true) {
+    std::string tmp_path = path + ".tmp";
+    if(reuse) {
+        int fd = open(tmp_path.c_str(), O_RDWR);
+        std::string reused_path = tmp_path;
+        if(fd >= 0) {
+            pending_path = path;
+        } else {
+            fd = open(path.c_str(), O_RDWR);
+            reused_path = path;
+        }
+        struct stat st;
+        if(fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size != std::max(bytes, (size_t)1)) {
+            std::cerr << "Could not reuse table file " << reused_path << ": " << (fd < 0 ? strerror(errno) : "wrong size") << "\n";
+            exit(1);
+        }
+        void* addr = mmap(nullptr, std::max(bytes, (size_t)1), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if(addr == MAP_FAILED) {
+            std::cerr << "Could not map table file " << reused_path << ": " << strerror(errno) << "\n";
+            exit(1);
+        }
+        ptr = (char*)addr;
+        return;
+    }
+
+    // ftruncate fills the file with zeros without writing them to the disk
+    int fd = open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0 || ftruncate(fd, std::max(bytes, (size_t)1)) != 0) {
+        std::cerr << "Could not create table file " << tmp_path << ": " << strerror(errno) << "\n";
+        exit(1);
+    }
+    void* addr = mmap(nullptr, std::max(bytes, (size_t)1), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(addr == MAP_FAILED) {
+        std::cerr << "Could not map table file " << tmp_path << ": " << strerror(errno) << "\n";
+        exit(1);
+    }
+    ptr = (char*)addr;
+    pending_path = path;
+}
+
+TableMemory::~TableMemory() {
+    munmap(ptr, std::max(bytes, (size_t)1));
+}
+
+void TableMemory::flush(size_t begin, size_t end) const {
+    if(!file_backed || begin >= end) {
+        return;
+    }
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    begin -= begin % page_size;
+    msync(ptr + begin, end - begin, MS_SYNC);
+}
+
+void TableMemory::finish() {
+    if(!file_backed) {
+        return;
+    }
+    flush(0, bytes);
+    if(!pending_path.empty()) {
+        std::string tmp_path = pending_path + ".tmp";
+        if(rename(tmp_path.c_str(), pending_path.c_str()) != 0) {
+            std::cerr << "Could not move table file " << tmp_path << " to " << pending_path << ": " << strerror(errno) << "\n";
+            exit(1);
+        }
+        pending_path.clear();
+    }
+}
@@ -1,27 +1,218 @@
 #pragma once
 
 #include "common.h"
+#include "numa.h"
 
 #include <immintrin.h> // _pext_u32
 
-template <typename T>
+// Returns the next larger integer with the same number of set bits.
+inline uint32_t next_same_popcount(uint32_t x) {
+    uint32_t lowest = x & -x;
+    uint32_t ripple = x + lowest;
+    return (((ripple ^ x) >> 2) / lowest) | ripple;
+}
+
+// Positions of the rows of a SubTable of size n in its flat storage. The rows
+// for the sets U with |U| = k (layer k) are stored contiguously, in the order
+// of increasing k, so that a table can be computed and written out layer by
+// layer. The layouts are shared between all tables of the same size.
+struct SubTableLayout {
+    // offset[U]: index of the entry (0, U)
+    std::vector<uint64_t> offset;
+    // layer_begin[k]: index of the first entry of layer k, layer_begin[n + 1]: number of entries
+    std::vector<uint64_t> layer_begin;
+
+    static std::shared_ptr<const SubTableLayout> get(uint32_t n);
+};
+
+// Zero-initialized memory allocated directly from the OS, optionally backed by
+// a file so that the OS can page it out of physical memory.
+class TableMemory {
+public:
+    explicit TableMemory(size_t bytes);
+    // The memory is written to the file path + ".tmp", which is created or
+    // truncated, and moved to path by finish(). A crash before that leaves
+    // no file at path, and an existing file at path stays valid until it
+    // is replaced atomically. If reuse is set, the existing file is mapped
+    // instead, keeping its contents: path + ".tmp" if it exists, since it
+    // holds a table that was not finished, and otherwise path. Its size
+    // must be bytes.
+    TableMemory(size_t bytes, const std::string& path, bool reuse = false);
+    ~TableMemory();
+
+    TableMemory(const TableMemory&) = delete;
+    TableMemory& operator=(const TableMemory&) = delete;
+
+    char* data() const {
+        return ptr;
+    }
+    size_t size() const {
+        return bytes;
+    }
+
+    // Writes the byte range [begin, end) back to the backing file, if any, so
+    // that the OS can evict it from physical memory without extra writes.
+    void flush(size_t begin, size_t end) const;
+    // Writes everything back to the backing file and moves it to its path, if
+    // it is not there yet.
+    void finish();
+
+private:
+    char* ptr;
+    size_t bytes;
+    bool file_backed;
+    // Nonempty until a new file is moved from path + ".tmp" to path
+    std::string pending_path;
+};
+
+// Table indexed by pairs (R, U) where R is a subset of U. The entries are
+// stored as type Stored, which may be a more compact representation of T
+// that converts to and from T. Stored must be trivially copyable, since the
+// table can be backed by a file.
+template <typename T, typename Stored = T>
 class SubTable {
 public:
-    SubTable(uint32_t n) {
-        data.resize(1 << n);
-        for(uint32_t U = 0; U < data.size(); ++U) {
-            data[U].resize(1 << __builtin_popcount(U));
+    SubTable(uint32_t n) : SubTable(n, std::string()) {}
+    SubTable() : SubTable(0) {}
+
+    // Table backed by the file at path, or in memory if path is empty. If
+    // reuse is set, the entries are read from the existing file at path,
+    // written earlier by a table of the same size and type. The entries of a
+    // new file are not initialized, so that creating the table does not page
+    // in the whole file: they read as Stored with all bits zero until written.
+    // The file only appears at path after finish().
+    SubTable(uint32_t n, const std::string& path, bool reuse = false) : layout(SubTableLayout::get(n)) {
+        size_t bytes = entry_count() * sizeof(Stored);
+        if(path.empty()) {
+            memory.reset(new TableMemory(bytes));
+        } else {
+            memory.reset(new TableMemory(bytes, path, reuse));
+        }
+        data = (Stored*)memory->data();
+        if(path.empty()) {
+            std::uninitialized_fill_n(data, entry_count(), Stored());
         }
     }
-    SubTable() : SubTable(0) {}
 
-    T& operator()(uint32_t R, uint32_t U) {
-        return data[U][_pext_u32(R, U)];
+    SubTable(const SubTable& other) :
+        layout(other.layout),
+        memory(new TableMemory(other.memory->size())),
+        data((Stored*)memory->data())
+    {
+        std::copy(other.data, other.data + entry_count(), data);
+    }
+    // Copy of other backed by the file at path, as above.
+    SubTable(const SubTable& other, const std::string& path) :
+        layout(other.layout),
+        memory(new TableMemory(other.memory->size(), path)),
+        data((Stored*)memory->data())
+    {
+        std::copy(other.data, other.data + entry_count(), data);
+    }
+    SubTable(SubTable&&) noexcept = default;
+
+    SubTable& operator=(SubTable other) noexcept {
+        std::swap(layout, other.layout);
+        std::swap(memory, other.memory);
+        std::swap(data, other.data);
+        return *this;
+    }
+
+    Stored& operator()(uint32_t R, uint32_t U) {
+        return data[layout->offset[U] + _pext_u32(R, U)];
+    }
+    const Stored& operator()(uint32_t R, uint32_t U) const {
+        return data[layout->offset[U] + _pext_u32(R, U)];
+    }
+
+    // The entries (R, U) of the row U, indexed by _pext_u32(R, U).
+    const Stored* row(uint32_t U) const {
+        return data + layout->offset[U];
+    }
+
+    template <typename F>
+    void for_each(F f) const {
+        for(size_t idx = 0; idx < entry_count(); ++idx) {
+            f(data[idx]);
+        }
+    }
+
+    // Writes the entries of the sets U with |U| = k back to the backing file, if any.
+    void flush_layer(int k) const {
+        memory->flush(layout->layer_begin[k] * sizeof(Stored), layout->layer_begin[k + 1] * sizeof(Stored));
+    }
+    // Called when all entries have been computed, see TableMemory::finish.
+    void finish() {
+        memory->finish();
+    }
+
+    // Spreads the entries evenly over the NUMA nodes.
+    void interleave(const std::vector<int>& nodes) const {
+        numa_interleave(memory->data(), memory->size(), nodes);
+    }
+
+private:
+    std::shared_ptr<const SubTableLayout> layout;
+    std::unique_ptr<TableMemory> memory;
+    Stored* data;
+
+    size_t entry_count() const {
+        return layout->layer_begin.back();
+    }
+};
+
+/*
+    Table of the hat weights hw(R, t) of a node, for R a subset of t, stored
+    as the SubTable entry (R, U) with U = (V \ t) | R, where V is the set of
+    all n nodes. When fs(S_0, U) is computed, the hat weights hw(S_0, t) of
+    the nodes in U \ S_0 are needed for t = V \ (U \ S_0), which are exactly
+    the entries in the row U. monotone_calculate_fs thus reads the rows of the
+    hat weight tables in the same order as it computes the rows of fs, one
+    layer of rows after another, and the hat weights are computed and written
+    in that order too (see calculate_node_hat_weights), so that tables in
+    files are read and written sequentially.
+*/
+template <typename T, typename Stored = T>
+class HatWeightTable {
+public:
+    HatWeightTable() : HatWeightTable(0) {}
+    // See SubTable
+    HatWeightTable(uint32_t n, const std::string& path = std::string(), bool reuse = false) :
+        table(n, path, reuse),
+        V((uint32_t)(((uint64_t)1 << n) - 1))
+    {}
+
+    // The hat weight hw(R, t)
+    Stored& operator()(uint32_t R, uint32_t t) {
+        return table(R, (V & ~t) | R);
+    }
+    const Stored& operator()(uint32_t R, uint32_t t) const {
+        return table(R, (V & ~t) | R);
+    }
+
+    // The entry (R, U) of the underlying SubTable, i.e. hw(R, (V \ U) | R)
+    Stored& by_row(uint32_t R, uint32_t U) {
+        return table(R, U);
+    }
+    const Stored& by_row(uint32_t R, uint32_t U) const {
+        return table(R, U);
+    }
+
+    template <typename F>
+    void for_each(F f) const {
+        table.for_each(f);
+    }
+    void flush_layer(int k) const {
+        table.flush_layer(k);
+    }
+    void finish() {
+        table.finish();
     }
-    const T& operator()(uint32_t R, uint32_t U) const {
-        return data[U][_pext_u32(R, U)];
+    void interleave(const std::vector<int>& nodes) const {
+        table.interleave(nodes);
     }
 
 private:
-    std::vector<std::vector<T>> data;
+    SubTable<T, Stored> table;
+    uint32_t V;
 };
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "common.h"
+#include "layering.h"
 #include "lognum.h"
 
 namespace symmetric_ {
@@ -22,9 +23,7 @@ std::vector<std::vector<T>> calculate_hat_weights(int size, int l_bound, const s
     }
 
 
-    hw[0][0] = T::one();
-
-    for(int t = 1; t < size; t++) 
+    for(int t = 0; t < size; t++) 
     {
         T sum;
         for(int j = 0; j <= t; j++) 
@@ -188,6 +187,85 @@ std::vector<int> sample_partition(int size, int l_bound, const std::vector<std::
 }
 
 
+// Samples the parents of the nodes in current_layer, given that they are in
+// the layer following parent_layer and the nodes before parent_layer are
+// ancestors. The probability of the sampled parent sets is multiplied into
+// probability.
+template <class T>
+void sample_layer_parents(const std::vector<T>& weights, const std::vector<std::vector<T>>& hws,
+    const std::vector<int>& ancestors, const std::vector<int>& parent_layer, const std::vector<int>& current_layer,
+    std::vector<int>& dag, T& probability) {
+
+    int parent_layer_size = (int) parent_layer.size();
+    int current_layer_size = (int) current_layer.size();
+
+    std::vector<T> upper_bounds_x(parent_layer_size);
+    upper_bounds_x[0] = T::zero();
+    T total = T::zero();
+    std::vector<std::vector<int>> pxs;
+
+    for(int xi = 0; xi < parent_layer_size; xi++) {
+        std::vector<int> px = ancestors;
+        for(int yi = 0; yi < parent_layer_size; yi++) {
+            if(parent_layer[yi] > parent_layer[xi]) {
+                px.push_back(parent_layer[yi]);
+            }
+        }
+        upper_bounds_x[xi] = hws[1][(int) px.size()+1];
+        total = total + upper_bounds_x[xi];
+        pxs.push_back(px);
+    }
+
+    for(int c = 0; c < current_layer_size; c++) {
+        int current_node = current_layer[c];
+
+        T random_number1 = T::uniform_rand(total);
+
+        int xi = 0;
+
+        T total2 = T::zero();
+
+        for(int i = 0; i < parent_layer_size; i++) {
+            total2 = total2 + upper_bounds_x[i];
+            if(total2 > random_number1) {
+                xi = i;
+                break;
+            }
+        }
+
+        int size_of_gi = 1;
+        std::vector<int> px = pxs[xi];
+        int size_of_px = (int) px.size() + 1;
+
+        std::vector<T> upper_bounds_size(size_of_px + 1);
+        upper_bounds_size[0] = T::zero();
+        for(int gi = 1; gi <= size_of_px; gi++) {
+            upper_bounds_size[gi] = upper_bounds_size[gi-1] + (T::binomial(size_of_px-1, gi-1)*weights[gi]);
+        }
+
+        T random_number2 = T::uniform_rand(upper_bounds_size[size_of_px]);
+
+        for(int gi = 1; gi <= size_of_px; gi++) {
+            if(upper_bounds_size[gi] > random_number2) {
+                size_of_gi = gi;
+                break;
+            }
+        }
+
+        shuffle(px.begin(), px.end(), rng);
+
+        dag[current_node] = 0;
+        for (int i = 0; i < size_of_gi-1; ++i)
+        {
+            dag[current_node] |= 1 << px[i];
+        }
+
+        dag[current_node] |= 1 << parent_layer[xi];
+        probability = probability*(weights[size_of_gi]/total);
+
+    }
+}
+
 template <class T>
 std::vector<int> sample_parents(int size, const std::vector<T>& weights, const std::vector<std::vector<T>>& hws, const std::vector<int>& partition) {
     /*
@@ -206,7 +284,7 @@ std::vector<int> sample_parents(int size, const std::vector<T>& weights, const s
         nodenames.push_back(i);
     }
 
-    shuffle(nodenames.begin(), nodenames.end(), std::random_device());
+    shuffle(nodenames.begin(), nodenames.end(), rng);
 
     int index = 0;
     for(int i = 0; i < (int) partition.size(); i++) {
@@ -221,82 +299,15 @@ std::vector<int> sample_parents(int size, const std::vector<T>& weights, const s
         layering[i] = layer_vector;
     }
 
+    T probability = T::one();
     std::vector<int> ancestors = {};
     for (int j = 1; j < partition_length; ++j)
     {
-        std::vector<int> parent_layer = layering[j-1];
-        std::vector<int> current_layer = layering[j];
-
-        int parent_layer_size = (int) parent_layer.size();
-        int current_layer_size = (int) current_layer.size();
-
-        std::vector<T> upper_bounds_x(parent_layer_size);
-        upper_bounds_x[0] = T::zero();
-        T total = T::zero();
-        std::vector<std::vector<int>> pxs;
-
-        for(int xi = 0; xi < parent_layer_size; xi++) {
-            std::vector<int> px = ancestors;
-            for(int yi = 0; yi < parent_layer_size; yi++) {
-                if(parent_layer[yi] > parent_layer[xi]) {
-                    px.push_back(parent_layer[yi]);
-                }
-            }
-            upper_bounds_x[xi] = hws[1][(int) px.size()+1];
-            total = total + upper_bounds_x[xi];
-            pxs.push_back(px);
-        }
-
-        for(int c = 0; c < current_layer_size; c++) {
-            int current_node = current_layer[c];
+        sample_layer_parents<T>(weights, hws, ancestors, layering[j-1], layering[j], dag, probability);
 
-            T random_number1 = T::uniform_rand(total);
-
-            int xi = 0;
-
-            T total2 = T::zero();
-
-            for(int i = 0; i < parent_layer_size; i++) {
-                total2 = total2 + upper_bounds_x[i];
-                if(total2 > random_number1) {
-                    xi = i;
-                    break;
-                }
-            }
-
-            int size_of_gi = 1;
-            std::vector<int> px = pxs[xi];
-            int size_of_px = (int) px.size() + 1;
-
-            std::vector<T> upper_bounds_size(size_of_px + 1);
-            upper_bounds_size[0] = T::zero();
-            for(int gi = 1; gi <= size_of_px; gi++) {
-                upper_bounds_size[gi] = upper_bounds_size[gi-1] + (T::binomial(size_of_px-1, gi-1)*weights[gi]);
-            }
-
-            T random_number2 = T::uniform_rand(upper_bounds_size[size_of_px]);
-
-            for(int gi = 1; gi <= size_of_px; gi++) {
-                if(upper_bounds_size[gi] > random_number2) {
-                    size_of_gi = gi;
-                    break;
-                }
-            }
-
-            shuffle(px.begin(), px.end(), std::random_device());
-
-            for (int i = 0; i < size_of_gi-1; ++i)
-            {
-                dag[current_node] |= 1 << px[i];
-            }
-
-            dag[current_node] |= 1 << parent_layer[xi];
-
-        }
-
-        for (int p = 0; p < parent_layer_size; ++p)
+        for (int p : layering[j-1])
         {
-            ancestors.push_back(parent_layer[p]);
+            ancestors.push_back(p);
         }
 
     }
@@ -320,6 +331,59 @@ public:
         std::vector<int> partition = sample_partition<T>(weights.size(), weights.size(), rus, hw);
         return sample_parents<T>(weights.size(), weights, hw, partition);
     }
+
+    int size() const {
+        return weights.size();
+    }
+
+    // Total weight of all DAGs, i.e. the normalizing constant of the distribution.
+    T total_weight() const {
+        using namespace symmetric_;
+
+        int size = weights.size();
+        T total = T::zero();
+        for(int r = 1; r <= size; ++r) {
+            total = total + number_of_compatible_dags<T>(size, size, r, 0, rus, hw);
+        }
+        return total;
+    }
+
+    // Keeps the layering of dag (see dag_layering) and the parents of the
+    // other nodes, and samples the parents of the nodes in the bitmask nodes
+    // from the conditional distribution. This is a Gibbs move for the DAG
+    // distribution. log_probability is set to the logarithm of the
+    // conditional probability of the returned DAG.
+    std::vector<int> resample_parents(std::vector<int> dag, int nodes, double& log_probability) const {
+        using namespace symmetric_;
+
+        std::vector<int> layering = dag_layering(dag);
+        assert(dag.size() == weights.size() && !layering.empty());
+
+        T probability = T::one();
+        std::vector<int> ancestors;
+        std::vector<int> parent_layer;
+        for(int j = 1; j < (int)layering.size(); ++j) {
+            std::vector<int> layer;
+            std::vector<int> current_layer;
+            for(int i = 0; i < (int)weights.size(); ++i) {
+                if(layering[j] & (1 << i)) {
+                    layer.push_back(i);
+                    if(nodes & (1 << i)) {
+                        current_layer.push_back(i);
+                    }
+                }
+            }
+            if(j >= 2 && !current_layer.empty()) {
+                sample_layer_parents<T>(weights, hw, ancestors, parent_layer, current_layer, dag, probability);
+            }
+            ancestors.insert(ancestors.end(), parent_layer.begin(), parent_layer.end());
+            parent_layer = std::move(layer);
+        }
+
+        log_probability = probability.to_log();
+        return dag;
+    }
+
 private:
     WeightT weights;
     std::vector<std::vector<T>> hw;
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "common.h"
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Fixed-size pool of worker threads that run tasks in submission order.
+class ThreadPool {
+public:
+    ThreadPool(int thread_count) {
+        assert(thread_count > 0);
+        for(int i = 0; i < thread_count; ++i) {
+            threads.emplace_back([this]() { work(); });
+        }
+    }
+
+    // Waits for all submitted tasks to finish.
+    ~ThreadPool() {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cv.notify_all();
+        for(std::thread& thread : threads) {
+            thread.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void submit(std::function<void()> task) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            tasks.push_back(std::move(task));
+        }
+        cv.notify_one();
+    }
+
+    static int default_thread_count() {
+        return std::max(1, (int)std::thread::hardware_concurrency());
+    }
+
+private:
+    std::vector<std::thread> threads;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stopping = false;
+
+    void work() {
+        while(true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [this]() { return stopping || !tasks.empty(); });
+                if(tasks.empty()) {
+                    return;
+                }
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+};
@@ -0,0 +1,80 @@
+#include "common.h"
+#include "constraints.h"
+#include "readwrite.h"
+#include "verify.h"
+
+#include <functional>
+
+// Runs the oracle checks of verify.h on the small models in the model
+// directory, and the batch command of the sampler binary. Used by make check.
+
+namespace {
+
+// Enough for the goodness-of-fit tests to detect a weight that is off by 10%
+const int NUMBER_OF_DAGS = 20000;
+
+struct Check {
+    std::string name;
+    std::function<bool(std::ostream&)> run;
+};
+
+}
+
+int main(int argc, char* argv[]) {
+    if(argc != 3) {
+        std::cerr << "Usage: test/check <model_directory> <sampler_binary>\n";
+        return 1;
+    }
+    std::string models = argv[1];
+    std::string sampler = argv[2];
+    auto model = [&](const std::string& name) {
+        return models + "/" + name;
+    };
+
+    std::vector<Check> checks;
+    checks.push_back({"symmetric", [&](std::ostream& out) {
+        return verify_symmetric(read_symmetric_weights<Lognum>(model("symmetric5.txt")), NUMBER_OF_DAGS, out);
+    }});
+    checks.push_back({"symmetric with constraints", [&](std::ostream& out) {
+        std::vector<Lognum> weights = read_symmetric_weights<Lognum>(model("symmetric5.txt"));
+        std::vector<std::vector<Lognum>> expanded = expand_symmetric_weights(weights);
+        Constraints constraints = read_constraints(model("symmetric5_constraints.txt"), weights.size());
+        apply_constraints_or_throw(expanded, constraints);
+        return verify_nonsymmetric(expanded, NUMBER_OF_DAGS, out, constraints.layer_order());
+    }});
+    for(std::string name : {"nonsymmetric3.txt", "nonsymmetric5.txt"}) {
+        checks.push_back({name, [=](std::ostream& out) {
+            return verify_nonsymmetric(read_nonsymmetric_weights<Lognum>(model(name)), NUMBER_OF_DAGS, out);
+        }});
+    }
+    checks.push_back({"nonsymmetric with constraints", [&](std::ostream& out) {
+        std::vector<int> earlier;
+        std::vector<std::vector<Lognum>> weights = read_nonsymmetric_weights<Lognum>(
+            model("nonsymmetric5.txt"), model("nonsymmetric5_constraints.txt"), &earlier);
+        return verify_nonsymmetric(weights, NUMBER_OF_DAGS, out, earlier);
+    }});
+    checks.push_back({"batch", [&](std::ostream& out) {
+        return verify_batch(sampler, {model("nonsymmetric3.txt"), model("nonsymmetric5.txt")}, NUMBER_OF_DAGS, out);
+    }});
+
+    int failures = 0;
+    for(const Check& check : checks) {
+        std::cout << "== " << check.name << " ==\n";
+        // Each check is reproducible on its own
+        rng.seed(1);
+        bool ok;
+        try {
+            ok = check.run(std::cout);
+        } catch(const std::exception& e) {
+            std::cout << e.what() << "\n";
+            ok = false;
+        }
+        if(!ok) {
+            ++failures;
+        }
+        std::cout << (ok ? "ok" : "FAILED") << "\n\n";
+    }
+
+    std::cout << checks.size() - failures << " of " << checks.size() << " checks passed\n";
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,225 @@
+#include "oracle.h"
+
+DagOracle::DagOracle(const std::vector<std::vector<Lognum>>& weights, const Condition& condition) :
+    weights(weights),
+    condition(condition)
+{
+    assert((int)weights.size() <= MAX_SIZE);
+
+    std::vector<int> dag(size(), 0);
+    enumerate(0, 0, 0, 0, 0.0, dag);
+    std::sort(dags.begin(), dags.end());
+
+    double max_log = -INFINITY;
+    for(const std::pair<uint64_t, double>& entry : dags) {
+        max_log = std::max(max_log, entry.second);
+    }
+    double sum = 0.0;
+    for(const std::pair<uint64_t, double>& entry : dags) {
+        sum += std::exp(entry.second - max_log);
+    }
+    log_total = max_log + std::log(sum);
+    log_max = max_log;
+
+    int n = size();
+    edge_probability.assign(n * n, 0.0);
+    for(std::pair<uint64_t, double>& entry : dags) {
+        entry.second = std::exp(entry.second - log_total);
+        for(int i = 0; i < n; ++i) {
+            int parents = (entry.first >> (MAX_SIZE * i)) & ((1 << MAX_SIZE) - 1);
+            for(; parents; parents &= parents - 1) {
+                edge_probability[i * n + __builtin_ctz(parents)] += entry.second;
+            }
+        }
+    }
+}
+
+uint64_t DagOracle::key(const std::vector<int>& dag) {
+    uint64_t ret = 0;
+    for(size_t i = 0; i < dag.size(); ++i) {
+        ret |= (uint64_t)dag[i] << (MAX_SIZE * i);
+    }
+    return ret;
+}
+
+// Every DAG is enumerated exactly once, together with its layering (see
+// dag_layering). The nodes of each layer get parent sets among the placed
+// nodes that intersect the previous layer prev. remaining holds the nodes of
+// the current layer that do not have a parent set yet; when it is empty, the
+// layer is placed and the next layer is chosen.
+void DagOracle::enumerate(int placed, int prev, int layer, int remaining, double log_weight, std::vector<int>& dag) {
+    int V = (1 << size()) - 1;
+
+    if(remaining) {
+        int node = __builtin_ctz(remaining);
+        int U = placed & ~prev;
+        // Parent sets: nonempty subsets of the previous layer together with any subset of the earlier layers
+        for(int G = 0; ; G = (G - U) & U) {
+            for(int H = prev; H; H = (H - 1) & prev) {
+                Lognum weight = weights[node][G | H];
+                if(weight > Lognum::zero()) {
+                    dag[node] = G | H;
+                    enumerate(placed, prev, layer, remaining & (remaining - 1), log_weight + weight.to_log(), dag);
+                }
+            }
+            if(G == U) {
+                break;
+            }
+        }
+        dag[node] = 0;
+        return;
+    }
+
+    if(layer) {
+        placed |= layer;
+        prev = layer;
+    }
+    int unplaced = V & ~placed;
+    if(!unplaced) {
+        if(!condition || condition(dag)) {
+            dags.emplace_back(key(dag), log_weight);
+        }
+        return;
+    }
+    for(int R = unplaced; R; R = (R - 1) & unplaced) {
+        if(!placed) {
+            // The nodes of the first layer have no parents
+            double layer_weight = log_weight;
+            bool positive = true;
+            for(int bits = R; bits; bits &= bits - 1) {
+                Lognum weight = weights[__builtin_ctz(bits)][0];
+                positive = positive && weight > Lognum::zero();
+                layer_weight += weight.to_log();
+            }
+            if(positive) {
+                enumerate(0, 0, R, 0, layer_weight, dag);
+            }
+        } else {
+            enumerate(placed, prev, R, R, log_weight, dag);
+        }
+    }
+}
+
+double DagOracle::probability(const std::vector<int>& dag) const {
+    auto it = std::lower_bound(dags.begin(), dags.end(), std::make_pair(key(dag), 0.0));
+    return it != dags.end() && it->first == key(dag) ? it->second : 0.0;
+}
+
+Lognum DagOracle::hat_weight(int node, int R, int t) const {
+    Lognum sum = Lognum::zero();
+    for(int S = 0; S < (int)weights[node].size(); ++S) {
+        if((S & ~t) == 0 && (R == 0 || (S & R) != 0)) {
+            sum = sum + weights[node][S];
+        }
+    }
+    return sum;
+}
+
+std::vector<int> DagOracle::decode(uint64_t key) const {
+    std::vector<int> dag(size());
+    for(int i = 0; i < size(); ++i) {
+        dag[i] = (key >> (MAX_SIZE * i)) & ((1 << MAX_SIZE) - 1);
+    }
+    return dag;
+}
+
+double DagOracle::condition_probability(const Condition& condition) const {
+    double ret = 0.0;
+    for(const std::pair<uint64_t, double>& entry : dags) {
+        if(condition(decode(entry.first))) {
+            ret += entry.second;
+        }
+    }
+    return ret;
+}
+
+DagOracle::GoodnessOfFit DagOracle::test(const std::vector<std::vector<int>>& samples) const {
+    return test(dags, edge_probability, size(), samples);
+}
+
+DagOracle::GoodnessOfFit DagOracle::test(const std::vector<std::vector<int>>& samples, const Condition& condition) const {
+    int n = size();
+    std::vector<std::pair<uint64_t, double>> conditional;
+    double total = 0.0;
+    for(const std::pair<uint64_t, double>& entry : dags) {
+        if(condition(decode(entry.first))) {
+            conditional.push_back(entry);
+            total += entry.second;
+        }
+    }
+
+    std::vector<double> conditional_edge_probability(n * n, 0.0);
+    for(std::pair<uint64_t, double>& entry : conditional) {
+        entry.second /= total;
+        std::vector<int> dag = decode(entry.first);
+        for(int i = 0; i < n; ++i) {
+            for(int parents = dag[i]; parents; parents &= parents - 1) {
+                conditional_edge_probability[i * n + __builtin_ctz(parents)] += entry.second;
+            }
+        }
+    }
+    return test(conditional, conditional_edge_probability, n, samples);
+}
+
+DagOracle::GoodnessOfFit DagOracle::test(const std::vector<std::pair<uint64_t, double>>& distribution,
+    const std::vector<double>& edge_probability, int n, const std::vector<std::vector<int>>& samples) {
+
+    GoodnessOfFit ret;
+    ret.impossible = 0;
+
+    double count = samples.size();
+
+    std::vector<uint64_t> observed(distribution.size(), 0);
+    std::vector<uint64_t> edge_counts(n * n, 0);
+    for(const std::vector<int>& dag : samples) {
+        auto it = std::lower_bound(distribution.begin(), distribution.end(), std::make_pair(key(dag), 0.0));
+        if(it == distribution.end() || it->first != key(dag)) {
+            ++ret.impossible;
+        } else {
+            ++observed[it - distribution.begin()];
+        }
+        for(int i = 0; i < n; ++i) {
+            for(int parents = dag[i]; parents; parents &= parents - 1) {
+                ++edge_counts[i * n + __builtin_ctz(parents)];
+            }
+        }
+    }
+
+    ret.chi_squared = 0.0;
+    int categories = 0;
+    double pooled_expected = 0.0;
+    double pooled_observed = 0.0;
+    for(size_t idx = 0; idx < distribution.size(); ++idx) {
+        double expected = count * distribution[idx].second;
+        if(expected < 5.0) {
+            pooled_expected += expected;
+            pooled_observed += observed[idx];
+        } else {
+            ret.chi_squared += (observed[idx] - expected) * (observed[idx] - expected) / expected;
+            ++categories;
+        }
+    }
+    if(pooled_expected > 0.0) {
+        ret.chi_squared += (pooled_observed - pooled_expected) * (pooled_observed - pooled_expected) / pooled_expected;
+        ++categories;
+    }
+    ret.degrees_of_freedom = std::max(categories - 1, 1);
+
+    double k = ret.degrees_of_freedom;
+    double z = (std::cbrt(ret.chi_squared / k) - (1.0 - 2.0 / (9.0 * k))) / std::sqrt(2.0 / (9.0 * k));
+    ret.p_value = 0.5 * std::erfc(z / std::sqrt(2.0));
+
+    ret.max_edge_z = 0.0;
+    for(int e = 0; e < n * n; ++e) {
+        double p = edge_probability[e];
+        double deviation = std::fabs(edge_counts[e] - count * p);
+        double sd = std::sqrt(count * p * (1.0 - p));
+        if(sd > 0.0) {
+            ret.max_edge_z = std::max(ret.max_edge_z, deviation / sd);
+        } else if(deviation > 0.5) {
+            ret.max_edge_z = INFINITY;
+        }
+    }
+
+    return ret;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "common.h"
+#include "lognum.h"
+
+#include <functional>
+
+// Exact distribution of the DAGs under modular weights, computed by
+// enumerating all DAGs of positive weight. This is independent of the
+// dynamic programming of the samplers and only feasible for small n.
+class DagOracle {
+public:
+    // There are 3781503 DAGs on 6 nodes.
+    static const int MAX_SIZE = 6;
+
+    struct GoodnessOfFit {
+        // Pearson's chi-squared statistic over the DAGs, pooling the DAGs
+        // with expected count below 5 into one category
+        double chi_squared;
+        int degrees_of_freedom;
+        // Upper tail probability of chi_squared, using the Wilson-Hilferty
+        // normal approximation of the chi-squared distribution
+        double p_value;
+        // Largest |z|-score of the count of an edge
+        double max_edge_z;
+        // Number of sampled DAGs of zero probability
+        uint64_t impossible;
+    };
+
+    // Selects the DAGs of a conditional distribution
+    typedef std::function<bool(const std::vector<int>&)> Condition;
+
+    // If a condition is given, only the DAGs that satisfy it are enumerated,
+    // giving the conditional distribution.
+    explicit DagOracle(const std::vector<std::vector<Lognum>>& weights, const Condition& condition = Condition());
+
+    int size() const {
+        return weights.size();
+    }
+    size_t dag_count() const {
+        return dags.size();
+    }
+    // Logarithm of the total weight of all DAGs
+    double log_total_weight() const {
+        return log_total;
+    }
+    // Logarithm of the largest weight of a DAG
+    double log_max_weight() const {
+        return log_max;
+    }
+
+    // Exact probability of the DAG; zero for DAGs of zero weight and graphs with cycles
+    double probability(const std::vector<int>& dag) const;
+    // Total probability of the DAGs that satisfy the condition
+    double condition_probability(const Condition& condition) const;
+
+    // The hat weight \hat{w}_node(R, t) computed from its definition: the sum
+    // of the weights of the parent sets S of t that intersect R, or of all
+    // parent sets S of t if R is empty.
+    Lognum hat_weight(int node, int R, int t) const;
+
+    GoodnessOfFit test(const std::vector<std::vector<int>>& samples) const;
+    // Tests the samples against the distribution conditioned on the condition
+    GoodnessOfFit test(const std::vector<std::vector<int>>& samples, const Condition& condition) const;
+
+private:
+    std::vector<std::vector<Lognum>> weights;
+    Condition condition;
+    // (key of the DAG, probability), sorted by key
+    std::vector<std::pair<uint64_t, double>> dags;
+    double log_total;
+    double log_max;
+    // edge_probability[i * n + j]: probability that j is a parent of i
+    std::vector<double> edge_probability;
+
+    static uint64_t key(const std::vector<int>& dag);
+    std::vector<int> decode(uint64_t key) const;
+    // Tests the samples against the given distribution, sorted by key, and its edge probabilities
+    static GoodnessOfFit test(const std::vector<std::pair<uint64_t, double>>& distribution,
+        const std::vector<double>& edge_probability, int n, const std::vector<std::vector<int>>& samples);
+    void enumerate(int placed, int prev, int layer, int remaining, double log_weight, std::vector<int>& dag);
+};
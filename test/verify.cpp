@@ -0,0 +1,657 @@
+#include "verify.h"
+#include "constraints.h"
+#include "fixed.h"
+#include "layering.h"
+#include "maxlognum.h"
+#include "nonsymmetric.h"
+#include "numa.h"
+#include "oracle.h"
+#include "readwrite.h"
+#include "symmetric.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <iomanip>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+
+// A correct engine fails the goodness-of-fit test with probability MIN_P_VALUE
+const double MIN_P_VALUE = 1e-4;
+const double MAX_EDGE_Z = 5.0;
+// Allowed logarithmic error of the total weight and the table entries, in addition to the storage error
+const double MAX_LOG_ERROR = 1e-9;
+// Number of threads of the multithreaded sampling checks
+const int SAMPLING_THREADS = 4;
+
+struct EngineReport {
+    std::string name;
+    double log_total_error;
+    // Negative if the tables are not compared
+    double table_error;
+    double tolerance;
+    // False if the engine does not sample from the distribution, so that fit is not tested
+    bool fit_tested;
+    DagOracle::GoodnessOfFit fit;
+    double precomputation;
+    double per_dag;
+
+    bool passed() const {
+        return log_total_error <= tolerance && table_error <= tolerance
+            && (!fit_tested || (fit.impossible == 0 && fit.p_value >= MIN_P_VALUE && fit.max_edge_z <= MAX_EDGE_Z));
+    }
+};
+
+class Timer {
+public:
+    Timer() : last(std::chrono::steady_clock::now()) {}
+
+    // Seconds since the construction or the previous call
+    double lap() {
+        auto now = std::chrono::steady_clock::now();
+        double ret = std::chrono::duration<double>(now - last).count();
+        last = now;
+        return ret;
+    }
+
+private:
+    std::chrono::steady_clock::time_point last;
+};
+
+// Temporary directory for table files, removed together with its files on destruction.
+class TempDir {
+public:
+    TempDir() {
+        const char* tmp = std::getenv("TMPDIR");
+        std::string pattern = std::string(tmp && *tmp ? tmp : "/tmp") + "/sampler-verify-XXXXXX";
+        std::vector<char> buffer(pattern.begin(), pattern.end());
+        buffer.push_back('\0');
+        if(!mkdtemp(buffer.data())) {
+            std::cerr << "Could not create a temporary directory in " << pattern << ": " << std::strerror(errno) << "\n";
+            exit(1);
+        }
+        path = buffer.data();
+    }
+    TempDir(const TempDir&) = delete;
+    TempDir& operator=(const TempDir&) = delete;
+
+    ~TempDir() {
+        if(DIR* dir = opendir(path.c_str())) {
+            while(dirent* entry = readdir(dir)) {
+                std::string name = entry->d_name;
+                if(name != "." && name != "..") {
+                    unlink((path + "/" + name).c_str());
+                }
+            }
+            closedir(dir);
+        }
+        rmdir(path.c_str());
+    }
+
+    std::string path;
+};
+
+double log_difference(Lognum a, Lognum b) {
+    if(a == Lognum::zero() || b == Lognum::zero()) {
+        return a == b ? 0.0 : INFINITY;
+    }
+    return std::fabs(a.to_log() - b.to_log());
+}
+
+// Largest difference of the hat weight and fs table entries of the two samplers
+template <class A, class B>
+double table_difference(int size, const A& a, const B& b) {
+    int V = (1 << size) - 1;
+    double ret = 0.0;
+    for(int i = 0; i < size; ++i) {
+        int V_sub_i = V & ~(1 << i);
+        for(int t = 0; ; t = (t - V_sub_i) & V_sub_i) {
+            for(int R = 0; ; R = (R - t) & t) {
+                ret = std::max(ret, log_difference(a.hat_weight_entry(i, R, t), b.hat_weight_entry(i, R, t)));
+                if(R == t) {
+                    break;
+                }
+            }
+            if(t == V_sub_i) {
+                break;
+            }
+        }
+    }
+    for(int U = 0; U <= V; ++U) {
+        for(int R = U; R; R = (R - 1) & U) {
+            ret = std::max(ret, log_difference(a.fs_entry(R, U), b.fs_entry(R, U)));
+        }
+    }
+    return ret;
+}
+
+// Largest difference of the hat weights of the sampler from their definition
+template <class Sampler>
+double hat_weight_difference(const DagOracle& oracle, const Sampler& sampler) {
+    int size = oracle.size();
+    int V = (1 << size) - 1;
+    double ret = 0.0;
+    for(int i = 0; i < size; ++i) {
+        int V_sub_i = V & ~(1 << i);
+        for(int t = 0; ; t = (t - V_sub_i) & V_sub_i) {
+            for(int R = 0; ; R = (R - t) & t) {
+                ret = std::max(ret, log_difference(sampler.hat_weight_entry(i, R, t), oracle.hat_weight(i, R, t)));
+                if(R == t) {
+                    break;
+                }
+            }
+            if(t == V_sub_i) {
+                break;
+            }
+        }
+    }
+    return ret;
+}
+
+template <class Sampler>
+std::vector<std::vector<int>> sample_each(const Sampler& sampler, int number_of_dags) {
+    std::vector<std::vector<int>> dags;
+    for(int i = 0; i < number_of_dags; ++i) {
+        dags.push_back(sampler.sample());
+    }
+    return dags;
+}
+
+// Samples with thread_count threads as with --sampling-threads and --numa: the
+// threads are pinned to the NUMA nodes in turn and seeded from the calling
+// thread. With replicate, each thread uses the copy of the sampler made on its
+// node, and otherwise the tables of the sampler are interleaved over the nodes.
+template <class Sampler>
+std::vector<std::vector<int>> sample_threaded(const Sampler& sampler, int number_of_dags, int thread_count, bool replicate) {
+    NumaTopology topology = NumaTopology::detect();
+    int node_count = topology.nodes.size();
+
+    std::vector<std::unique_ptr<Sampler>> replicas;
+    if(replicate) {
+        replicas.resize(node_count);
+        std::vector<std::thread> threads;
+        for(int idx = 0; idx < node_count; ++idx) {
+            threads.emplace_back([&, idx]() {
+                pin_thread_to_node(topology, idx);
+                replicas[idx].reset(new Sampler(sampler));
+            });
+        }
+        for(std::thread& thread : threads) {
+            thread.join();
+        }
+    } else {
+        sampler.interleave_tables(topology.nodes);
+    }
+
+    std::vector<uint32_t> seeds;
+    for(int k = 0; k < thread_count; ++k) {
+        seeds.push_back(rng());
+    }
+    std::vector<std::vector<std::vector<int>>> thread_dags(thread_count);
+    std::vector<std::thread> threads;
+    for(int k = 0; k < thread_count; ++k) {
+        int count = number_of_dags / thread_count + (k < number_of_dags % thread_count);
+        threads.emplace_back([&, k, count]() {
+            pin_thread_to_node(topology, k % node_count);
+            rng.seed(seeds[k]);
+            const Sampler& local = replicas.empty() ? sampler : *replicas[k % node_count];
+            thread_dags[k] = sample_each(local, count);
+        });
+    }
+    for(std::thread& thread : threads) {
+        thread.join();
+    }
+
+    std::vector<std::vector<int>> dags;
+    for(std::vector<std::vector<int>>& part : thread_dags) {
+        dags.insert(dags.end(), part.begin(), part.end());
+    }
+    return dags;
+}
+
+template <class Sampler>
+EngineReport make_report(const std::string& name, const DagOracle& oracle, const Sampler& sampler,
+    const std::vector<std::vector<int>>& dags, double precomputation, double sampling) {
+
+    EngineReport report;
+    report.name = name;
+    report.log_total_error = std::fabs(sampler.total_weight().to_log() - oracle.log_total_weight());
+    report.table_error = -1.0;
+    report.tolerance = MAX_LOG_ERROR;
+    report.fit_tested = true;
+    report.fit = oracle.test(dags);
+    report.precomputation = precomputation;
+    report.per_dag = sampling / dags.size();
+    return report;
+}
+
+template <int N>
+void check_fixed(const std::vector<std::vector<Lognum>>& weights, const std::vector<int>& earlier, int number_of_dags,
+    const DagOracle& oracle, const NonSymmetricSampler<Lognum>& reference, std::vector<EngineReport>& reports) {
+
+    if((int)weights.size() != N) {
+        check_fixed<N - 1>(weights, earlier, number_of_dags, oracle, reference, reports);
+        return;
+    }
+
+    Timer timer;
+    FixedNonSymmetricSampler<Lognum, N> sampler(weights, earlier);
+    double precomputation = timer.lap();
+    std::vector<std::vector<int>> dags = sample_each(sampler, number_of_dags);
+    reports.push_back(make_report("fixed", oracle, sampler, dags, precomputation, timer.lap()));
+    reports.back().table_error = table_difference(N, sampler, reference);
+
+    dags = sampler.sample_batch(number_of_dags);
+    reports.push_back(make_report("fixed, batched", oracle, sampler, dags, precomputation, timer.lap()));
+    reports.back().table_error = reports[reports.size() - 2].table_error;
+
+    dags = sample_threaded(sampler, number_of_dags, SAMPLING_THREADS, true);
+    reports.push_back(make_report("fixed, threads, replicated", oracle, sampler, dags, precomputation, timer.lap()));
+    reports.back().table_error = reports[reports.size() - 3].table_error;
+}
+
+template <>
+void check_fixed<0>(const std::vector<std::vector<Lognum>>&, const std::vector<int>&, int, const DagOracle&,
+    const NonSymmetricSampler<Lognum>&, std::vector<EngineReport>&) {}
+
+// A DAG with many layers, drawn from the sampler, to condition on
+template <class Sampler>
+std::vector<int> deep_dag(const Sampler& sampler) {
+    std::vector<int> ret = sampler.sample();
+    for(int i = 0; i < 100; ++i) {
+        std::vector<int> dag = sampler.sample();
+        if(dag_layering(dag).size() > dag_layering(ret).size()) {
+            ret = dag;
+        }
+    }
+    return ret;
+}
+
+// Checks a conditional sampling move against the exact distribution
+// conditioned on condition. move(log_probability) returns a DAG and sets
+// log_probability to its conditional probability, whose largest error is
+// reported as the total error.
+template <class Move>
+EngineReport check_conditional(const std::string& name, const DagOracle& oracle, const DagOracle::Condition& condition,
+    int number_of_dags, double precomputation, Move move) {
+
+    double log_condition = std::log(oracle.condition_probability(condition));
+    double max_error = 0.0;
+    Timer timer;
+    std::vector<std::vector<int>> dags;
+    for(int i = 0; i < number_of_dags; ++i) {
+        double log_probability;
+        dags.push_back(move(log_probability));
+        double exact = std::log(oracle.probability(dags.back())) - log_condition;
+        max_error = std::max(max_error, std::isfinite(exact) ? std::fabs(log_probability - exact) : INFINITY);
+    }
+    double sampling = timer.lap();
+
+    EngineReport report;
+    report.name = name;
+    report.log_total_error = max_error;
+    report.table_error = -1.0;
+    report.tolerance = MAX_LOG_ERROR;
+    report.fit_tested = true;
+    report.fit = oracle.test(dags, condition);
+    report.precomputation = precomputation;
+    report.per_dag = sampling / number_of_dags;
+    return report;
+}
+
+// Condition of resample_parents: the DAGs with the layering of dag in which
+// the nodes outside the bitmask nodes have the same parents as in dag.
+DagOracle::Condition same_layering_and_parents(const std::vector<int>& dag, int nodes) {
+    std::vector<int> layering = dag_layering(dag);
+    return [=](const std::vector<int>& other) {
+        for(size_t i = 0; i < dag.size(); ++i) {
+            if(!(nodes & (1 << i)) && other[i] != dag[i]) {
+                return false;
+            }
+        }
+        return dag_layering(other) == layering;
+    };
+}
+
+// Checks resample_parents of the sampler, resampling every other node of a deep DAG.
+template <class Sampler>
+EngineReport check_resample_parents(const std::string& name, const DagOracle& oracle, const Sampler& sampler,
+    int number_of_dags, double precomputation) {
+
+    std::vector<int> dag = deep_dag(sampler);
+    int nodes = 0x15555555 & ((1 << dag.size()) - 1);
+    return check_conditional(name, oracle, same_layering_and_parents(dag, nodes), number_of_dags, precomputation,
+        [&](double& log_probability) {
+            return sampler.resample_parents(dag, nodes, log_probability);
+        });
+}
+
+// Checks sample_from_prefix of the sampler, keeping half of the layers of a deep DAG.
+template <class Sampler>
+EngineReport check_sample_from_prefix(const std::string& name, const DagOracle& oracle, const Sampler& sampler,
+    int number_of_dags, double precomputation) {
+
+    std::vector<int> dag = deep_dag(sampler);
+    std::vector<int> layering = dag_layering(dag);
+    int prefix_length = (layering.size() - 1) / 2;
+    int kept = 0;
+    for(int j = 1; j <= prefix_length; ++j) {
+        kept |= layering[j];
+    }
+
+    // The DAGs whose layering starts with the kept layers, with the same parents for their nodes
+    DagOracle::Condition condition = [=](const std::vector<int>& other) {
+        for(size_t i = 0; i < dag.size(); ++i) {
+            if((kept & (1 << i)) && other[i] != dag[i]) {
+                return false;
+            }
+        }
+        std::vector<int> other_layering = dag_layering(other);
+        return (int)other_layering.size() > prefix_length
+            && std::equal(layering.begin(), layering.begin() + prefix_length + 1, other_layering.begin());
+    };
+    return check_conditional(name, oracle, condition, number_of_dags, precomputation,
+        [&](double& log_probability) {
+            return sampler.sample_from_prefix(dag, prefix_length, log_probability);
+        });
+}
+
+// The weights with those of the node changed, keeping the parent sets of
+// positive weight: the weight of each parent set is multiplied by e^(1 + its size).
+std::vector<std::vector<Lognum>> perturb_weights(std::vector<std::vector<Lognum>> weights, int node) {
+    for(size_t S = 0; S < weights[node].size(); ++S) {
+        weights[node][S] = weights[node][S] * Lognum::from_log(1.0 + __builtin_popcount(S));
+    }
+    return weights;
+}
+
+// Checks update_weights of the sampler, which was built from perturb_weights(weights, 0):
+// after restoring the weights of node 0, it must match a sampler built from the weights.
+template <class Sampler>
+void check_update_weights(const std::string& name, Sampler& sampler, const std::vector<std::vector<Lognum>>& weights,
+    int number_of_dags, const DagOracle& oracle, const NonSymmetricSampler<Lognum>& reference, std::vector<EngineReport>& reports) {
+
+    Timer timer;
+    sampler.update_weights(0, weights[0]);
+    double precomputation = timer.lap();
+    std::vector<std::vector<int>> dags = sample_each(sampler, number_of_dags);
+    reports.push_back(make_report(name, oracle, sampler, dags, precomputation, timer.lap()));
+    reports.back().table_error = table_difference(weights.size(), sampler, reference);
+}
+
+// The disk engine of --table-dir, with the tables in files in a temporary
+// directory, and a sampler that maps the finished files as with --resume,
+// both after building and after update_weights.
+void check_table_files(const std::vector<std::vector<Lognum>>& weights, const std::vector<int>& earlier, int number_of_dags,
+    const DagOracle& oracle, const NonSymmetricSampler<Lognum>& reference, std::vector<EngineReport>& reports) {
+
+    TempDir dir;
+    Timer timer;
+    {
+        NonSymmetricSampler<Lognum> sampler(weights, dir.path, false, earlier);
+        double precomputation = timer.lap();
+        std::vector<std::vector<int>> dags = sample_each(sampler, number_of_dags);
+        reports.push_back(make_report("disk", oracle, sampler, dags, precomputation, timer.lap()));
+        reports.back().table_error = table_difference(weights.size(), sampler, reference);
+    }
+
+    timer.lap();
+    NonSymmetricSampler<Lognum> resumed(weights, dir.path, true, earlier);
+    double precomputation = timer.lap();
+    std::vector<std::vector<int>> dags = sample_each(resumed, number_of_dags);
+    reports.push_back(make_report("disk, resumed", oracle, resumed, dags, precomputation, timer.lap()));
+    reports.back().table_error = table_difference(weights.size(), resumed, reference);
+
+    TempDir update_dir;
+    NonSymmetricSampler<Lognum> updated(perturb_weights(weights, 0), update_dir.path, false, earlier);
+    check_update_weights("disk, updated weights", updated, weights, number_of_dags, oracle, reference, reports);
+
+    // The updated files must be in place, with progress saved for the new weights
+    timer.lap();
+    NonSymmetricSampler<Lognum> updated_resumed(weights, update_dir.path, true, earlier);
+    precomputation = timer.lap();
+    dags = sample_each(updated_resumed, number_of_dags);
+    reports.push_back(make_report("disk, updated and resumed", oracle, updated_resumed, dags, precomputation, timer.lap()));
+    reports.back().table_error = table_difference(weights.size(), updated_resumed, reference);
+}
+
+// The maximum weight DAG of --map: both the total weight of the max-times
+// sampler and the weight of the DAG it returns must be the largest weight of
+// a DAG.
+void check_map(const std::vector<std::vector<Lognum>>& weights, const std::vector<int>& earlier, const DagOracle& oracle,
+    std::vector<EngineReport>& reports) {
+    std::vector<std::vector<MaxLognum>> max_weights(weights.size());
+    for(size_t i = 0; i < weights.size(); ++i) {
+        for(Lognum weight : weights[i]) {
+            max_weights[i].push_back(MaxLognum::from_log(weight.to_log()));
+        }
+    }
+
+    Timer timer;
+    NonSymmetricSampler<MaxLognum> sampler(std::move(max_weights), "", false, earlier);
+    double precomputation = timer.lap();
+    std::vector<int> dag = sampler.sample();
+    double sampling = timer.lap();
+
+    double probability = oracle.probability(dag);
+    double log_weight = probability > 0.0 ? std::log(probability) + oracle.log_total_weight() : -INFINITY;
+
+    EngineReport report;
+    report.name = "maximum weight DAG";
+    report.log_total_error = std::max(std::fabs(sampler.total_weight().to_log() - oracle.log_max_weight()),
+        std::fabs(log_weight - oracle.log_max_weight()));
+    report.table_error = -1.0;
+    report.tolerance = MAX_LOG_ERROR;
+    report.fit_tested = false;
+    report.fit = DagOracle::GoodnessOfFit();
+    report.precomputation = precomputation;
+    report.per_dag = sampling;
+    reports.push_back(report);
+}
+
+void check_nonsymmetric_engines(const std::vector<std::vector<Lognum>>& weights, const std::vector<int>& earlier, int number_of_dags,
+    const DagOracle& oracle, std::vector<EngineReport>& reports) {
+
+    Timer timer;
+    NonSymmetricSampler<Lognum> reference(weights, "", false, earlier);
+    double precomputation = timer.lap();
+    std::vector<std::vector<int>> dags = sample_each(reference, number_of_dags);
+    reports.push_back(make_report("generic", oracle, reference, dags, precomputation, timer.lap()));
+    reports.back().table_error = hat_weight_difference(oracle, reference);
+
+    dags = reference.sample_batch(number_of_dags);
+    reports.push_back(make_report("generic, batched", oracle, reference, dags, precomputation, timer.lap()));
+    reports.back().table_error = reports[reports.size() - 2].table_error;
+
+    dags = sample_threaded(reference, number_of_dags, SAMPLING_THREADS, false);
+    reports.push_back(make_report("generic, threads, interleaved", oracle, reference, dags, precomputation, timer.lap()));
+    reports.back().table_error = reports[reports.size() - 3].table_error;
+
+    reports.push_back(check_sample_from_prefix("generic, from prefix", oracle, reference, number_of_dags, precomputation));
+    reports.push_back(check_resample_parents("generic, resampled parents", oracle, reference, number_of_dags, precomputation));
+
+    timer.lap();
+    NonSymmetricSampler<Lognum, LogFloat> single(weights, "", false, earlier);
+    precomputation = timer.lap();
+    dags = sample_each(single, number_of_dags);
+    reports.push_back(make_report("generic, float tables", oracle, single, dags, precomputation, timer.lap()));
+    reports.back().table_error = table_difference(weights.size(), single, reference);
+    reports.back().tolerance += single.storage_error_bound();
+
+    NonSymmetricSampler<Lognum> updated(perturb_weights(weights, 0), "", false, earlier);
+    check_update_weights("generic, updated weights", updated, weights, number_of_dags, oracle, reference, reports);
+
+    check_table_files(weights, earlier, number_of_dags, oracle, reference, reports);
+    check_map(weights, earlier, oracle, reports);
+    check_fixed<fixed_::MAX_SIZE>(weights, earlier, number_of_dags, oracle, reference, reports);
+}
+
+// The DAGs whose layering satisfies the layer ordering earlier (see
+// Constraints::layer_order), checked from the definition, or no condition
+// for an empty ordering.
+DagOracle::Condition layer_order_condition(const std::vector<int>& earlier) {
+    if(earlier.empty()) {
+        return DagOracle::Condition();
+    }
+    return [=](const std::vector<int>& dag) {
+        std::vector<int> layering = dag_layering(dag);
+        int placed = 0;
+        for(size_t j = 1; j < layering.size(); ++j) {
+            for(int bits = layering[j]; bits; bits &= bits - 1) {
+                if(earlier[__builtin_ctz(bits)] & ~placed) {
+                    return false;
+                }
+            }
+            placed |= layering[j];
+        }
+        return true;
+    };
+}
+
+bool write_reports(const DagOracle& oracle, const std::vector<EngineReport>& reports, std::ostream& out) {
+    out << "Exact distribution: " << oracle.dag_count() << " DAGs of positive weight, log total weight " << oracle.log_total_weight() << "\n";
+    out << std::left << std::setw(32) << "engine" << std::right
+        << std::setw(14) << "total error" << std::setw(14) << "table error"
+        << std::setw(12) << "chi^2" << std::setw(8) << "df" << std::setw(12) << "p-value" << std::setw(12) << "max |z|"
+        << std::setw(16) << "precomputation" << std::setw(12) << "per DAG" << "  result\n";
+
+    bool ok = true;
+    for(const EngineReport& report : reports) {
+        out << std::left << std::setw(32) << report.name << std::right << std::setprecision(4)
+            << std::setw(14) << report.log_total_error;
+        if(report.table_error >= 0.0) {
+            out << std::setw(14) << report.table_error;
+        } else {
+            out << std::setw(14) << "-";
+        }
+        if(report.fit_tested) {
+            out << std::setw(12) << report.fit.chi_squared << std::setw(8) << report.fit.degrees_of_freedom
+                << std::setw(12) << report.fit.p_value << std::setw(12) << report.fit.max_edge_z;
+        } else {
+            out << std::setw(12) << "-" << std::setw(8) << "-" << std::setw(12) << "-" << std::setw(12) << "-";
+        }
+        out << std::setw(15) << report.precomputation << "s" << std::setw(11) << report.per_dag << "s"
+            << "  " << (report.passed() ? "ok" : "FAILED");
+        if(report.fit.impossible) {
+            out << " (" << report.fit.impossible << " DAGs of zero probability)";
+        }
+        out << "\n";
+        ok = ok && report.passed();
+    }
+    return ok;
+}
+
+// Parses the DAGs written by the sampler, one per line in the format
+// "0 <- {}, 1 <- {0, 2}, ..."
+std::vector<std::vector<int>> read_dags(const std::string& filename, int size) {
+    std::ifstream file(filename);
+    if(!file.is_open()) {
+        throw std::runtime_error("Could not open " + filename);
+    }
+    std::vector<std::vector<int>> dags;
+    std::string line;
+    while(std::getline(file, line)) {
+        std::vector<int> dag(size, 0);
+        std::istringstream parts(line);
+        std::string part;
+        int node = 0;
+        // Each part is "<node> <- {<parents>" after the previous "}"
+        while(std::getline(parts, part, '}') && node < size) {
+            size_t open = part.find('{');
+            if(open == std::string::npos) {
+                break;
+            }
+            std::string parents = part.substr(open + 1);
+            std::replace(parents.begin(), parents.end(), ',', ' ');
+            std::istringstream parent_stream(parents);
+            int parent;
+            while(parent_stream >> parent) {
+                dag[node] |= 1 << parent;
+            }
+            ++node;
+        }
+        if(node != size) {
+            throw std::runtime_error("Invalid DAG in " + filename + ": " + line);
+        }
+        dags.push_back(dag);
+    }
+    return dags;
+}
+
+}
+
+bool verify_batch(const std::string& sampler_path, const std::vector<std::string>& weight_files, int number_of_dags,
+    std::ostream& out) {
+    TempDir dir;
+    std::string manifest = dir.path + "/manifest.txt";
+    {
+        std::ofstream file(manifest);
+        for(size_t idx = 0; idx < weight_files.size(); ++idx) {
+            file << weight_files[idx] << " " << number_of_dags << " " << idx + 1 << " " << dir.path << "/out" << idx << ".txt\n";
+        }
+    }
+
+    std::string log = dir.path + "/log.txt";
+    std::string command = sampler_path + " batch " + manifest + " --threads 2 2> " + log;
+    if(std::system(command.c_str()) != 0) {
+        std::ifstream log_file(log);
+        std::stringstream messages;
+        messages << log_file.rdbuf();
+        out << "Command failed: " << command << "\n" << messages.str();
+        return false;
+    }
+
+    bool ok = true;
+    for(size_t idx = 0; idx < weight_files.size(); ++idx) {
+        std::vector<std::vector<Lognum>> weights = read_nonsymmetric_weights<Lognum>(weight_files[idx]);
+        DagOracle oracle(weights);
+        std::vector<std::vector<int>> dags = read_dags(dir.path + "/out" + std::to_string(idx) + ".txt", weights.size());
+
+        EngineReport report;
+        report.name = "batch, " + std::to_string(dags.size()) + " DAGs";
+        report.log_total_error = 0.0;
+        report.table_error = -1.0;
+        report.tolerance = MAX_LOG_ERROR;
+        report.fit_tested = true;
+        report.fit = oracle.test(dags);
+        report.precomputation = 0.0;
+        report.per_dag = 0.0;
+        if(dags.size() != (size_t)number_of_dags) {
+            report.log_total_error = INFINITY;
+        }
+        out << weight_files[idx] << ":\n";
+        ok = write_reports(oracle, {report}, out) && ok;
+    }
+    return ok;
+}
+
+bool verify_nonsymmetric(const std::vector<std::vector<Lognum>>& weights, int number_of_dags, std::ostream& out,
+    const std::vector<int>& earlier) {
+    assert((int)weights.size() <= DagOracle::MAX_SIZE);
+
+    DagOracle oracle(weights, layer_order_condition(earlier));
+    std::vector<EngineReport> reports;
+    check_nonsymmetric_engines(weights, earlier, number_of_dags, oracle, reports);
+    return write_reports(oracle, reports, out);
+}
+
+bool verify_symmetric(const std::vector<Lognum>& weights, int number_of_dags, std::ostream& out) {
+    assert((int)weights.size() <= DagOracle::MAX_SIZE);
+
+    std::vector<std::vector<Lognum>> expanded = expand_symmetric_weights(weights);
+    DagOracle oracle(expanded);
+    std::vector<EngineReport> reports;
+
+    Timer timer;
+    SymmetricSampler<Lognum> sampler(weights);
+    double precomputation = timer.lap();
+    std::vector<std::vector<int>> dags = sample_each(sampler, number_of_dags);
+    reports.push_back(make_report("symmetric", oracle, sampler, dags, precomputation, timer.lap()));
+    reports.push_back(check_resample_parents("symmetric, resampled parents", oracle, sampler, number_of_dags, precomputation));
+
+    check_nonsymmetric_engines(expanded, {}, number_of_dags, oracle, reports);
+    return write_reports(oracle, reports, out);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "common.h"
+#include "lognum.h"
+
+/*
+    Differential check of the sampling engines against the exact distribution
+    computed by DagOracle, for at most DagOracle::MAX_SIZE nodes. Each engine
+    samples number_of_dags DAGs, and the report written to out shows for each
+    engine
+
+    - the error of its total weight of all DAGs,
+    - the largest difference of its table entries from those of the
+      reference NonSymmetricSampler<Lognum> (whose hat weights are compared
+      with their definition),
+    - a chi-squared goodness-of-fit test of the sampled DAGs and the largest
+      z-score of the edge counts,
+    - the precomputation time and the sampling time per DAG.
+
+    The engines include the tables in files (--table-dir, also resumed),
+    sampling on several threads pinned to the NUMA nodes (--sampling-threads
+    and --numa), and the maximum weight DAG of --map, whose weight is compared
+    with the largest weight of a DAG instead of testing a fit. The
+    conditional moves sample_from_prefix and resample_parents are tested
+    against the exact distribution conditioned on the kept part of a DAG, and
+    their total error is the largest error of the conditional probability
+    they return. update_weights is tested by building samplers in memory and
+    in files from weights with those of node 0 changed and restoring them.
+
+    The nonsymmetric engines are given the layer ordering earlier (see
+    Constraints::layer_order), and the exact distribution is conditioned on
+    it.
+
+    Returns false if some engine fails a check.
+*/
+bool verify_nonsymmetric(const std::vector<std::vector<Lognum>>& weights, int number_of_dags, std::ostream& out,
+    const std::vector<int>& earlier = std::vector<int>());
+bool verify_symmetric(const std::vector<Lognum>& weights, int number_of_dags, std::ostream& out);
+
+/*
+    Runs the batch command of the sampler binary at sampler_path on a
+    manifest of the weight files, each sampling number_of_dags DAGs, and
+    tests the fit of each output file. Returns false if the command fails or
+    some output does not fit.
+*/
+bool verify_batch(const std::string& sampler_path, const std::vector<std::string>& weight_files, int number_of_dags,
+    std::ostream& out);